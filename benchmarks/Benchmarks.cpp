@@ -0,0 +1,527 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "Bytecode.h"
+#include "Graph.h"
+#include "Jit.h"
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+#include "Sparse.h"
+#include "Tape.h"
+#if defined(AUTODIFF_GENERATED_EXAMPLE)
+#include "Example.h"
+#endif
+
+// Evaluation throughput of representative expressions. Output follows the JSON layout of Google Benchmark
+// (context + benchmarks array) so existing tooling can compare runs:
+//   AutoDifferentiationBenchmarks [--benchmark_out=<file>] [--benchmark_min_time=<seconds>] [--benchmark_filter=<substring>]
+namespace {
+
+	// keeps value alive without letting the optimizer see what is done with it
+	template <typename T>
+	void doNotOptimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+		asm volatile("" : : "r,m"(value) : "memory");
+#else
+		static volatile char sink;
+		sink = *reinterpret_cast<const volatile char*>(&value);
+#endif
+	}
+
+	struct Result {
+		std::string name;
+		std::size_t iterations;
+		double nanoseconds;		// per iteration
+		std::size_t itemsPerIteration;
+	};
+
+	struct Options {
+		double minTime = 0.2;
+		std::string filter;
+		std::string out;
+	};
+
+	// body(iterations) runs the measured loop; iterations grow until one run lasts minTime
+	Result run(const std::string& name, std::size_t itemsPerIteration, const Options& options,
+			   const std::function<void(std::size_t)>& body) {
+		using Clock = std::chrono::steady_clock;
+
+		std::size_t iterations = 1;
+		while (true) {
+			auto start = Clock::now();
+			body(iterations);
+			double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+			if (seconds >= options.minTime || iterations >= (std::size_t(1) << 40)) {
+				return {name, iterations, seconds * 1e9 / double(iterations), itemsPerIteration};
+			}
+			// aim 40% past the target so the next run is usually the last
+			double scale = seconds > 0 ? options.minTime * 1.4 / seconds : 10;
+			iterations = std::max(iterations + 1, std::size_t(double(iterations) * std::min(scale, 10.0)));
+		}
+	}
+
+	// inputs that change every iteration so no call can be hoisted out of the loop
+	constexpr std::size_t inputCount = 1024;
+
+	std::vector<float> inputs(float low, float high) {
+		std::vector<float> xs(inputCount);
+		for (std::size_t i = 0; i < inputCount; ++i) xs[i] = low + (high - low) * float(i) / float(inputCount);
+		return xs;
+	}
+
+	template <typename Expr>
+	void addSingleVar(std::vector<Result>& results, const Options& options, const std::string& family, const Expr& expr) {
+		const std::vector<float> xs = inputs(0.5f, 2.5f);
+		auto dExpr = expr.dx();
+		auto d2Expr = dExpr.dx();
+		auto d3Expr = d2Expr.dx();
+
+		auto measure = [&](const std::string& what, std::size_t items, const std::function<void(std::size_t)>& body) {
+			std::string name = "singleVarDiff/" + family + "/" + what;
+			if (name.find(options.filter) != std::string::npos) results.push_back(run(name, items, options, body));
+		};
+
+		measure("value", 1, [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) doNotOptimize(expr(xs[i % inputCount]));
+		});
+		measure("dx", 1, [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) doNotOptimize(dExpr(xs[i % inputCount]));
+		});
+		measure("evalDual", 1, [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) doNotOptimize(expr.evalDual(xs[i % inputCount]));
+		});
+		// value and first three derivatives - nested dx() expressions against one Taylor pass
+		measure("derivatives3/dx", 1, [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) {
+				float x = xs[i % inputCount];
+				doNotOptimize(std::array<float, 4>{expr(x), dExpr(x), d2Expr(x), d3Expr(x)});
+			}
+		});
+		measure("derivatives3/taylor", 1, [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) doNotOptimize(singleVarDiff::derivatives<3>(expr, xs[i % inputCount]));
+		});
+		measure("batch", inputCount, [&](std::size_t iterations) {
+			std::vector<float> out(inputCount);
+			for (std::size_t i = 0; i < iterations; ++i) {
+				singleVarDiff::evaluateBatch(expr, xs, out);
+				doNotOptimize(out.data());
+			}
+		});
+	}
+
+	// expr is written over IndexedVariable<0> and IndexedVariable<1>
+	template <typename Expr>
+	void addMultiVar(std::vector<Result>& results, const Options& options, const std::string& family, const Expr& expr) {
+		const std::vector<float> us = inputs(0.5f, 20.0f);
+		const std::vector<float> vs = inputs(1.0f, 300.0f);
+		auto dExpr = expr.dx(multiVarDiff::IndexedVariable<0>{});
+
+		auto measure = [&](const std::string& what, std::size_t items, const std::function<void(std::size_t)>& body) {
+			std::string name = "multiVarDiff/" + family + "/" + what;
+			if (name.find(options.filter) != std::string::npos) results.push_back(run(name, items, options, body));
+		};
+
+		measure("value", 1, [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, 2> values{us[i % inputCount], vs[i % inputCount]};
+				doNotOptimize(expr(std::span<const float>{values}));
+			}
+		});
+		measure("dx", 1, [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, 2> values{us[i % inputCount], vs[i % inputCount]};
+				doNotOptimize(dExpr(std::span<const float>{values}));
+			}
+		});
+		measure("gradient", 1, [&](std::size_t iterations) {
+			std::array<float, 2> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, 2> values{us[i % inputCount], vs[i % inputCount]};
+				doNotOptimize(multiVarDiff::gradient(expr, values, partials));
+				doNotOptimize(partials);
+			}
+		});
+		measure("batch", inputCount, [&](std::size_t iterations) {
+			std::vector<float> out(inputCount);
+			std::array<std::span<const float>, 2> columns{us, vs};
+			for (std::size_t i = 0; i < iterations; ++i) {
+				multiVarDiff::evaluateBatch(expr, columns, out);
+				doNotOptimize(out.data());
+			}
+		});
+	}
+
+	// gradient of a dense 16-variable model - every partial through its own dx() tree, by reverse accumulation, and
+	// by vector forward mode with 8 and 16 directions per pass
+	void addWideModel(std::vector<Result>& results, const Options& options) {
+		constexpr std::size_t width = 16;
+		const std::vector<float> xs = inputs(0.5f, 2.5f);
+		// every term reads the sum of all variables, so every partial depends on the whole expression
+		auto expr = []<std::size_t... i>(std::index_sequence<i...>) {
+			auto sum = (... + multiVarDiff::IndexedVariable<i>{});
+			return (... + (sin(multiVarDiff::IndexedVariable<i>{} * sum) / (1 + multiVarDiff::IndexedVariable<i>{} * multiVarDiff::IndexedVariable<i>{})));
+		}(std::make_index_sequence<width>{});
+
+		auto measure = [&](const std::string& what, const std::function<void(std::size_t)>& body) {
+			std::string name = "multiVarDiff/wide/" + what;
+			if (name.find(options.filter) != std::string::npos) results.push_back(run(name, 1, options, body));
+		};
+		auto point = [&](std::size_t i) {
+			std::array<float, width> values;
+			for (std::size_t slot = 0; slot < width; ++slot) values[slot] = xs[(i + slot) % inputCount];
+			return values;
+		};
+
+		auto derivatives = [&]<std::size_t... slot>(std::index_sequence<slot...>) {
+			return std::tuple{expr.dx(multiVarDiff::IndexedVariable<slot>{})...};
+		}(std::make_index_sequence<width>{});
+
+		measure("dx", [&](std::size_t iterations) {
+			std::array<float, width> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				[&]<std::size_t... slot>(std::index_sequence<slot...>) {
+					((partials[slot] = std::get<slot>(derivatives)(std::span<const float>{values})), ...);
+				}(std::make_index_sequence<width>{});
+				doNotOptimize(partials);
+			}
+		});
+		measure("gradient", [&](std::size_t iterations) {
+			std::array<float, width> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				doNotOptimize(multiVarDiff::gradient(expr, values, partials));
+				doNotOptimize(partials);
+			}
+		});
+		measure("forwardGradient8", [&](std::size_t iterations) {
+			std::array<float, width> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				doNotOptimize(multiVarDiff::forwardGradient<8>(expr, values, partials));
+				doNotOptimize(partials);
+			}
+		});
+		measure("forwardGradient16", [&](std::size_t iterations) {
+			std::array<float, width> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				doNotOptimize(multiVarDiff::forwardGradient<16>(expr, values, partials));
+				doNotOptimize(partials);
+			}
+		});
+		// the same model written as loops and recorded afresh at every point
+		measure("tape", [&](std::size_t iterations) {
+			tape::Tape& recording = tape::Tape::local();
+			std::array<tape::Active, width> x;
+			std::array<float, width> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				recording.clear();
+				for (std::size_t slot = 0; slot < width; ++slot) x[slot] = recording.input(values[slot]);
+				tape::Active sum = 0;
+				for (const tape::Active& xi : x) sum += xi;
+				tape::Active total = 0;
+				for (const tape::Active& xi : x) total += sin(xi * sum) / (1 + xi * xi);
+				doNotOptimize(recording.gradient(total, partials));
+				doNotOptimize(partials);
+			}
+		});
+		// recorded once, then replayed at every point
+		measure("tapeReplay", [&](std::size_t iterations) {
+			tape::Tape& recording = tape::Tape::local();
+			recording.clear();
+			tape::Active sum = 0;
+			std::array<tape::Active, width> x;
+			for (std::size_t slot = 0; slot < width; ++slot) sum += x[slot] = recording.input(xs[slot]);
+			tape::Active total = 0;
+			for (const tape::Active& xi : x) total += sin(xi * sum) / (1 + xi * xi);
+
+			std::array<float, width> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				doNotOptimize(recording.replay(values));
+				doNotOptimize(recording.gradient(total, partials));
+				doNotOptimize(partials);
+			}
+		});
+	}
+
+	// chain model where every variable meets only its neighbours - tridiagonal Hessian, bidiagonal Jacobian
+	void addBandedModel(std::vector<Result>& results, const Options& options) {
+		constexpr std::size_t width = 16;
+		const std::vector<float> xs = inputs(0.5f, 2.5f);
+		auto expr = []<std::size_t... i>(std::index_sequence<i...>) {
+			return (... + (multiVarDiff::IndexedVariable<i>{} * multiVarDiff::IndexedVariable<i + 1>{} + sin(multiVarDiff::IndexedVariable<i>{})));
+		}(std::make_index_sequence<width - 1>{});
+		auto rows = []<std::size_t... i>(std::index_sequence<i...>) {
+			return std::tuple{(multiVarDiff::IndexedVariable<i>{} * multiVarDiff::IndexedVariable<i + 1>{} - exp(multiVarDiff::IndexedVariable<i>{}))...};
+		}(std::make_index_sequence<width - 1>{});
+		constexpr std::size_t rowCount = width - 1;
+
+		auto measure = [&](const std::string& what, const std::function<void(std::size_t)>& body) {
+			std::string name = "multiVarDiff/banded/" + what;
+			if (name.find(options.filter) != std::string::npos) results.push_back(run(name, 1, options, body));
+		};
+		auto point = [&](std::size_t i) {
+			std::array<float, width> values;
+			for (std::size_t slot = 0; slot < width; ++slot) values[slot] = xs[(i + slot) % inputCount];
+			return values;
+		};
+
+		measure("hessian", [&](std::size_t iterations) {
+			std::array<float, width * width> out;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				doNotOptimize(multiVarDiff::hessian(expr, values, out));
+				doNotOptimize(out);
+			}
+		});
+		// patterns and colorings are worked out once per model, outside the timed loop
+		sparse::SparseHessian sparseHessian(expr);
+		sparse::SparseJacobian sparseJacobian(rows);
+
+		measure("sparseHessian", [&](std::size_t iterations) {
+			sparse::Matrix<float> out = sparseHessian.matrix();
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				doNotOptimize(sparseHessian.evaluate(values, out));
+				doNotOptimize(out.values.data());
+			}
+		});
+		measure("jacobian", [&](std::size_t iterations) {
+			std::array<float, rowCount * width> out;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				doNotOptimize(multiVarDiff::jacobian(rows, values, out, multiVarDiff::Layout::RowMajor));
+				doNotOptimize(out);
+			}
+		});
+		measure("sparseJacobian", [&](std::size_t iterations) {
+			sparse::Matrix<float> out = sparseJacobian.matrix();
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, width> values = point(i);
+				doNotOptimize(sparseJacobian.evaluate(values, out));
+				doNotOptimize(out.values.data());
+			}
+		});
+	}
+
+	// the main.cpp example with variables bound by address
+	void addBoundExample(std::vector<Result>& results, const Options& options) {
+		const std::vector<float> xs = inputs(0.5f, 20.0f);
+		const std::vector<float> ys = inputs(1.0f, 300.0f);
+
+		multiVarDiff::Variable x;
+		multiVarDiff::Variable y;
+		auto expr = x * x + 4 * y * y / (x + 5);
+		auto dExpr = expr.dx(x);
+
+		auto measure = [&](const std::string& what, const std::function<void(std::size_t)>& body) {
+			std::string name = "multiVarDiff/example-bound/" + what;
+			if (name.find(options.filter) != std::string::npos) results.push_back(run(name, 1, options, body));
+		};
+
+		measure("value", [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) doNotOptimize(expr(x = xs[i % inputCount], y = ys[i % inputCount]));
+		});
+		measure("dx", [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) doNotOptimize(dExpr(x = xs[i % inputCount], y = ys[i % inputCount]));
+		});
+		measure("gradient", [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) doNotOptimize(multiVarDiff::gradient(expr, x = xs[i % inputCount], y = ys[i % inputCount]));
+		});
+	}
+
+#if defined(AUTODIFF_GENERATED_EXAMPLE)
+	// the main.cpp example as code generated at build time by AutoDifferentiationCodegen
+	void addGeneratedExample(std::vector<Result>& results, const Options& options) {
+		const std::vector<float> xs = inputs(0.5f, 20.0f);
+		const std::vector<float> ys = inputs(1.0f, 300.0f);
+
+		auto measure = [&](const std::string& what, const std::function<void(std::size_t)>& body) {
+			std::string name = "codegen/example/" + what;
+			if (name.find(options.filter) != std::string::npos) results.push_back(run(name, 1, options, body));
+		};
+
+		measure("value", [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) doNotOptimize(example(xs[i % inputCount], ys[i % inputCount]));
+		});
+		measure("gradient", [&](std::size_t iterations) {
+			std::array<float, 2> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				doNotOptimize(exampleGradient(xs[i % inputCount], ys[i % inputCount], partials.data()));
+				doNotOptimize(partials);
+			}
+		});
+	}
+#endif
+
+	// the main.cpp example as a runtime graph
+	void addGraphExample(std::vector<Result>& results, const Options& options) {
+		const std::vector<float> xs = inputs(0.5f, 20.0f);
+		const std::vector<float> ys = inputs(1.0f, 300.0f);
+
+		graph::Graph<float> expr;
+		graph::NodeId x = expr.variable(0);
+		graph::NodeId y = expr.variable(1);
+		graph::NodeId root = expr.sum(expr.product(x, x),
+									  expr.quotient(expr.product(expr.product(expr.constant(4), y), y), expr.sum(x, expr.constant(5))));
+
+		std::vector<float> values(expr.size());
+		std::vector<float> adjoints(expr.size());
+
+		auto measure = [&](const std::string& what, const std::function<void(std::size_t)>& body) {
+			std::string name = "graph/example/" + what;
+			if (name.find(options.filter) != std::string::npos) results.push_back(run(name, 1, options, body));
+		};
+
+		measure("value", [&](std::size_t iterations) {
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, 2> point{xs[i % inputCount], ys[i % inputCount]};
+				expr.evaluate(point, values);
+				doNotOptimize(values[root]);
+			}
+		});
+		measure("gradient", [&](std::size_t iterations) {
+			std::array<float, 2> partials;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, 2> point{xs[i % inputCount], ys[i % inputCount]};
+				expr.evaluate(point, values);
+				expr.gradient(root, values, adjoints, partials);
+				doNotOptimize(partials);
+			}
+		});
+
+		// value and partials from one run of the compiled adjoint graph
+		bytecode::Program<float> program{graph::gradientGraph(expr, root)};
+		auto measureBytecode = [&](const std::string& what, const std::function<void(std::size_t)>& body) {
+			std::string name = "bytecode/example/" + what;
+			if (name.find(options.filter) != std::string::npos) results.push_back(run(name, 1, options, body));
+		};
+		measureBytecode("gradient", [&](std::size_t iterations) {
+			std::array<float, 3> outputs;
+			for (std::size_t i = 0; i < iterations; ++i) {
+				std::array<float, 2> point{xs[i % inputCount], ys[i % inputCount]};
+				program(point, outputs);
+				doNotOptimize(outputs);
+			}
+		});
+
+		// the same program as native code - skipped where the JIT cannot emit
+		jit::NativeProgram<float> native{program};
+		if (native) {
+			measureBytecode("gradient/jit", [&](std::size_t iterations) {
+				std::array<float, 3> outputs;
+				for (std::size_t i = 0; i < iterations; ++i) {
+					std::array<float, 2> point{xs[i % inputCount], ys[i % inputCount]};
+					native(point, outputs);
+					doNotOptimize(outputs);
+				}
+			});
+		}
+	}
+
+	std::string escape(const std::string& text) {
+		std::string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') escaped += '\\';
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	void writeJson(std::FILE* file, const std::vector<Result>& results, const char* executable) {
+		char date[64];
+		std::time_t now = std::time(nullptr);
+		std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+		std::fprintf(file, "{\n  \"context\": {\n");
+		std::fprintf(file, "    \"date\": \"%s\",\n", date);
+		std::fprintf(file, "    \"executable\": \"%s\",\n", escape(executable).c_str());
+		std::fprintf(file, "    \"num_cpus\": %u,\n", std::thread::hardware_concurrency());
+		std::fprintf(file, "    \"simd_width\": %zu,\n", simd::FloatPack::width);
+#ifdef NDEBUG
+		std::fprintf(file, "    \"library_build_type\": \"release\"\n");
+#else
+		std::fprintf(file, "    \"library_build_type\": \"debug\"\n");
+#endif
+		std::fprintf(file, "  },\n  \"benchmarks\": [\n");
+		for (std::size_t i = 0; i < results.size(); ++i) {
+			const Result& result = results[i];
+			std::fprintf(file, "    {\n");
+			std::fprintf(file, "      \"name\": \"%s\",\n", escape(result.name).c_str());
+			std::fprintf(file, "      \"run_type\": \"iteration\",\n");
+			std::fprintf(file, "      \"iterations\": %zu,\n", result.iterations);
+			std::fprintf(file, "      \"real_time\": %.4f,\n", result.nanoseconds);
+			std::fprintf(file, "      \"time_unit\": \"ns\",\n");
+			std::fprintf(file, "      \"items_per_second\": %.6e\n", double(result.itemsPerIteration) * 1e9 / result.nanoseconds);
+			std::fprintf(file, "    }%s\n", i + 1 < results.size() ? "," : "");
+		}
+		std::fprintf(file, "  ]\n}\n");
+	}
+
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.starts_with("--benchmark_out=")) options.out = arg.substr(std::strlen("--benchmark_out="));
+		else if (arg.starts_with("--benchmark_min_time=")) options.minTime = std::stod(arg.substr(std::strlen("--benchmark_min_time=")));
+		else if (arg.starts_with("--benchmark_filter=")) options.filter = arg.substr(std::strlen("--benchmark_filter="));
+		else {
+			std::fprintf(stderr, "unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+
+	std::vector<Result> results;
+
+	{
+		singleVarDiff::Variable x;
+		addSingleVar(results, options, "polynomial", 3 * x * x * x - 2 * x * x + x - 7);
+		addSingleVar(results, options, "rational", (x * x + 1) / (x * x - 4 * x + 5));
+		addSingleVar(results, options, "nested-product", x * (x + 1) * (x + 2) * (x + 3) * (x + 4) * (x + 5) * (x + 6) * (x + 7));
+	}
+	{
+		multiVarDiff::IndexedVariable<0> u;
+		multiVarDiff::IndexedVariable<1> v;
+		addMultiVar(results, options, "polynomial", 3 * u * u * v - 2 * u * v * v + u - 7);
+		addMultiVar(results, options, "rational", (u * v + 1) / (u * u + v + 5));
+		addMultiVar(results, options, "example", u * u + 4 * v * v / (u + 5));
+		addMultiVar(results, options, "nested-product", u * (v + 1) * (u + 2) * (v + 3) * (u + 4) * (v + 5) * (u + 6) * (v + 7));
+		addBoundExample(results, options);
+		addWideModel(results, options);
+		addBandedModel(results, options);
+	}
+	addGraphExample(results, options);
+#if defined(AUTODIFF_GENERATED_EXAMPLE)
+	addGeneratedExample(results, options);
+#endif
+
+	if (options.out.empty()) {
+		writeJson(stdout, results, argv[0]);
+		return 0;
+	}
+
+	std::FILE* file = std::fopen(options.out.c_str(), "w");
+	if (!file) {
+		std::fprintf(stderr, "cannot open %s\n", options.out.c_str());
+		return 1;
+	}
+	writeJson(file, results, argv[0]);
+	std::fclose(file);
+	return 0;
+}
@@ -0,0 +1,53 @@
+# Times the compilation of each compile-time probe and writes the results as Google Benchmark style JSON.
+# Run through the AutoDifferentiationCompileBenchmarks target, which passes:
+#   COMPILER, COMPILER_ID, SOURCE_DIR, BINARY_DIR, OUTPUT, REPETITIONS
+cmake_minimum_required(VERSION 3.23)	# string(TIMESTAMP) with %f
+
+file(GLOB PROBES "${SOURCE_DIR}/benchmarks/compile/*.cpp")
+list(SORT PROBES)
+
+if (COMPILER_ID STREQUAL "MSVC")
+	set(FLAGS /nologo /std:c++latest /EHsc /O2 /c "/I${SOURCE_DIR}/src")
+	set(OBJECT_FLAG "/Fo")
+else()
+	set(FLAGS -std=c++23 -O2 -c "-I${SOURCE_DIR}/src")
+	set(OBJECT_FLAG "-o")
+endif()
+
+string(TIMESTAMP DATE "%Y-%m-%dT%H:%M:%S")
+set(JSON "{\n  \"context\": {\n    \"date\": \"${DATE}\",\n    \"compiler\": \"${COMPILER_ID}\"\n  },\n  \"benchmarks\": [\n")
+
+set(FIRST TRUE)
+foreach (PROBE ${PROBES})
+	get_filename_component(NAME "${PROBE}" NAME_WE)
+	set(OBJECT "${BINARY_DIR}/${NAME}.probe.o")
+
+	# best of the repetitions - the least disturbed by other work on the machine
+	set(BEST "")
+	foreach (REPETITION RANGE 1 ${REPETITIONS})
+		string(TIMESTAMP START "%s%f" UTC)
+		execute_process(COMMAND "${COMPILER}" ${FLAGS} "${PROBE}" "${OBJECT_FLAG}${OBJECT}" RESULT_VARIABLE RESULT)
+		string(TIMESTAMP END "%s%f" UTC)
+		if (NOT RESULT EQUAL 0)
+			message(FATAL_ERROR "compiling ${PROBE} failed")
+		endif()
+
+		math(EXPR ELAPSED "${END} - ${START}")
+		if (BEST STREQUAL "" OR ELAPSED LESS BEST)
+			set(BEST ${ELAPSED})
+		endif()
+	endforeach()
+
+	file(SIZE "${OBJECT}" OBJECT_SIZE)
+	message(STATUS "compile/${NAME}: ${BEST} us")
+
+	if (NOT FIRST)
+		string(APPEND JSON ",\n")
+	endif()
+	set(FIRST FALSE)
+	string(APPEND JSON "    {\n      \"name\": \"compile/${NAME}\",\n      \"run_type\": \"iteration\",\n      \"iterations\": ${REPETITIONS},\n")
+	string(APPEND JSON "      \"real_time\": ${BEST},\n      \"time_unit\": \"us\",\n      \"object_bytes\": ${OBJECT_SIZE}\n    }")
+endforeach()
+
+string(APPEND JSON "\n  ]\n}\n")
+file(WRITE "${OUTPUT}" "${JSON}")
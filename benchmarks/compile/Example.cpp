@@ -0,0 +1,18 @@
+#include <array>
+#include "MultiVarDiff.h"
+
+// compile-time probe: the main.cpp example through every evaluation path
+float example(float at) {
+	multiVarDiff::Variable x;
+	multiVarDiff::Variable y;
+	auto bound = x * x + 4 * y * y / (x + 5);
+	auto grad = multiVarDiff::gradient(bound, x = at, y = at);
+
+	multiVarDiff::IndexedVariable<0> u;
+	multiVarDiff::IndexedVariable<1> v;
+	auto indexed = u * u + 4 * v * v / (u + 5);
+	std::array<float, 2> values{at, at};
+	std::array<float, 2> partials;
+
+	return bound.dx(x)(x = at, y = at) + grad[1] + indexed.dx(v)(values) + multiVarDiff::gradient(indexed, values, partials);
+}
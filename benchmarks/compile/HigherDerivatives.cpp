@@ -0,0 +1,16 @@
+#include <array>
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+
+// compile-time probe: fourth derivatives, whose types grow exponentially with the order until they are erased
+float higherDerivatives(float at) {
+	singleVarDiff::Variable x;
+	auto single = singleVarDiff::sin(x * x) / (1 + x * x) * singleVarDiff::exp(x / (x + 2));
+
+	multiVarDiff::IndexedVariable<0> u;
+	multiVarDiff::IndexedVariable<1> v;
+	auto multi = sin(u * v) / (1 + u * v) * exp(u / (v + 2));
+	std::array<float, 2> values{at, at};
+
+	return single.dx().dx().dx().dx()(at) + multi.dx(u).dx(v).dx(u).dx(v)(values);
+}
@@ -0,0 +1,16 @@
+#include <array>
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+
+// compile-time probe: deep products, whose derivative trees grow fastest
+float nestedProduct(float at) {
+	singleVarDiff::Variable x;
+	auto single = x * (x + 1) * (x + 2) * (x + 3) * (x + 4) * (x + 5) * (x + 6) * (x + 7);
+
+	multiVarDiff::IndexedVariable<0> u;
+	multiVarDiff::IndexedVariable<1> v;
+	auto multi = u * (v + 1) * (u + 2) * (v + 3) * (u + 4) * (v + 5) * (u + 6) * (v + 7);
+	std::array<float, 2> values{at, at};
+
+	return single.dx().dx()(at) + multi.dx(u).dx(v)(values);
+}
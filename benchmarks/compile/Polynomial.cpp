@@ -0,0 +1,16 @@
+#include <array>
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+
+// compile-time probe: polynomials and their first and second derivatives
+float polynomial(float at) {
+	singleVarDiff::Variable x;
+	auto single = 3 * x * x * x - 2 * x * x + x - 7;
+
+	multiVarDiff::IndexedVariable<0> u;
+	multiVarDiff::IndexedVariable<1> v;
+	auto multi = 3 * u * u * v - 2 * u * v * v + u - 7;
+	std::array<float, 2> values{at, at};
+
+	return single.dx().dx()(at) + multi.dx(u).dx(v)(values);
+}
@@ -0,0 +1,16 @@
+#include <array>
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+
+// compile-time probe: rational functions and their first and second derivatives
+float rational(float at) {
+	singleVarDiff::Variable x;
+	auto single = (x * x + 1) / (x * x - 4 * x + 5);
+
+	multiVarDiff::IndexedVariable<0> u;
+	multiVarDiff::IndexedVariable<1> v;
+	auto multi = (u * v + 1) / (u * u + v + 5);
+	std::array<float, 2> values{at, at};
+
+	return single.dx().dx()(at) + multi.dx(u).dx(v)(values);
+}
@@ -0,0 +1,18 @@
+#include <array>
+#include <cstddef>
+#include <span>
+#include <utility>
+#include "MultiVarDiff.h"
+
+// compile-time probe: every partial of a 16-variable model in which each term reads two variables
+float sparsePartials(std::span<const float> values) {
+	constexpr std::size_t width = 16;
+	auto model = []<std::size_t... i>(std::index_sequence<i...>) {
+		return (... + (sin(multiVarDiff::IndexedVariable<i>{} * multiVarDiff::IndexedVariable<(i + 1) % width>{}) /
+					   (1 + multiVarDiff::IndexedVariable<i>{} * multiVarDiff::IndexedVariable<i>{})));
+	}(std::make_index_sequence<width>{});
+
+	return [&]<std::size_t... i>(std::index_sequence<i...>) {
+		return (... + (model.dx(multiVarDiff::IndexedVariable<i>{})(values) + model.evalDual(multiVarDiff::IndexedVariable<i>{}, values).derivative));
+	}(std::make_index_sequence<width>{});
+}
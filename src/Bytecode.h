@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <vector>
+#include "Elementary.h"
+#include "Graph.h"
+#include "Lowering.h"
+
+// register-based bytecode for graphs - a compact instruction stream and a small register file instead of a walk
+// over nodes or a tree of recursive calls
+namespace bytecode {
+
+	enum class Opcode : std::uint8_t {
+		Constant,	// r[dst] = constants[a]
+		Input,		// r[dst] = inputs[a]
+		Add,		// r[dst] = r[a] + r[b]
+		Subtract,
+		Multiply,
+		Divide,
+		Exp,		// r[dst] = exp(r[a])
+		Log,
+		Sin,
+		Cos,
+		Sqrt,
+		Pow,		// r[dst] = pow(r[a], constants[b])
+		Output,		// outputs[dst] = r[a]
+		Halt
+	};
+
+	// three-address instruction - 8 bytes, so a cache line holds eight
+	struct Instruction {
+		Opcode opcode;
+		std::uint16_t dst;
+		std::uint16_t a;
+		std::uint16_t b;
+	};
+
+	// Compiled form of a graph's outputs. Nodes no output depends on are dropped, and registers are reused as soon
+	// as the last reader of a value has executed, so the register file is usually far smaller than the graph.
+	// Calls write into the program's own register file - use one Program per thread
+	template <typename Scalar>
+	class Program {
+	public:
+		// throws std::length_error when registers, constants or input slots exceed the 16-bit operand range
+		explicit Program(const graph::Graph<Scalar>& source) {
+			using graph::Op;
+			std::span<const graph::Node<Scalar>> nodes = source.nodes();
+			std::span<const graph::NodeId> outputs = source.outputs();
+			constexpr std::size_t unused = std::numeric_limits<std::size_t>::max();
+
+			// position of the last instruction that reads each node - outputs are read right after they are computed
+			std::vector<std::size_t> lastUse(nodes.size(), unused);
+			auto use = [&](std::size_t node, std::size_t at) {
+				if (lastUse[node] == unused || lastUse[node] < at) lastUse[node] = at;
+			};
+			for (graph::NodeId output : outputs) use(output, output);
+			for (std::size_t i = nodes.size(); i-- > 0;) {
+				if (lastUse[i] == unused) continue;
+				const graph::Node<Scalar>& node = nodes[i];
+				if (graph::isBinary(node.op) || graph::isUnary(node.op)) use(node.lhs, i);
+				if (graph::isBinary(node.op)) use(node.rhs, i);
+			}
+
+			std::vector<std::uint16_t> registerOf(nodes.size());
+			std::vector<std::uint16_t> free;
+			std::size_t registerCount = 0;
+
+			for (std::size_t i = 0; i < nodes.size(); ++i) {
+				if (lastUse[i] == unused) continue;
+				const graph::Node<Scalar>& node = nodes[i];
+
+				// operands die first, so the result may take the register of one of them
+				std::uint16_t a = 0;
+				std::uint16_t b = 0;
+				if (graph::isBinary(node.op) || graph::isUnary(node.op)) {
+					a = registerOf[node.lhs];
+					if (lastUse[node.lhs] == i) free.push_back(a);
+				}
+				if (graph::isBinary(node.op)) {
+					b = registerOf[node.rhs];
+					if (lastUse[node.rhs] == i && node.rhs != node.lhs) free.push_back(b);
+				}
+
+				std::uint16_t dst;
+				if (!free.empty()) {
+					dst = free.back();
+					free.pop_back();
+				}
+				else {
+					dst = narrow(registerCount++);
+				}
+				registerOf[i] = dst;
+
+				switch (node.op) {
+				case Op::Constant: code.push_back({Opcode::Constant, dst, constant(node.payload), 0}); break;
+				case Op::Variable: code.push_back({Opcode::Input, dst, narrow(node.lhs), 0}); break;
+				case Op::Sum: code.push_back({Opcode::Add, dst, a, b}); break;
+				case Op::Difference: code.push_back({Opcode::Subtract, dst, a, b}); break;
+				case Op::Product: code.push_back({Opcode::Multiply, dst, a, b}); break;
+				case Op::Quotient: code.push_back({Opcode::Divide, dst, a, b}); break;
+				case Op::Exp: code.push_back({Opcode::Exp, dst, a, 0}); break;
+				case Op::Log: code.push_back({Opcode::Log, dst, a, 0}); break;
+				case Op::Sin: code.push_back({Opcode::Sin, dst, a, 0}); break;
+				case Op::Cos: code.push_back({Opcode::Cos, dst, a, 0}); break;
+				case Op::Sqrt: code.push_back({Opcode::Sqrt, dst, a, 0}); break;
+				case Op::Pow: code.push_back({Opcode::Pow, dst, a, constant(node.payload)}); break;
+				}
+
+				for (std::size_t output = 0; output < outputs.size(); ++output) {
+					if (outputs[output] == i) code.push_back({Opcode::Output, narrow(output), dst, 0});
+				}
+				if (lastUse[i] == i) free.push_back(dst);
+			}
+
+			code.push_back({Opcode::Halt, 0, 0, 0});
+			registers.resize(registerCount);
+			outputCount = outputs.size();
+		}
+
+		// evaluates the graph's outputs at inputs
+		void operator()(std::span<const Scalar> inputs, std::span<Scalar> outputs) {
+			Scalar* r = registers.data();
+			const Scalar* k = constants.data();
+			const Instruction* ip = code.data();
+
+#if defined(__GNUC__) || defined(__clang__)
+			// threaded dispatch - each handler ends in its own indirect jump, which predicts far better than the
+			// single shared jump of a switch
+			static void* const handlers[] = {&&Constant, &&Input, &&Add, &&Subtract, &&Multiply, &&Divide,
+											 &&Exp, &&Log, &&Sin, &&Cos, &&Sqrt, &&Pow, &&Output, &&Halt};
+#define AUTODIFF_HANDLER(name) name:
+#define AUTODIFF_NEXT ++ip; goto *handlers[static_cast<std::size_t>(ip->opcode)]
+			goto *handlers[static_cast<std::size_t>(ip->opcode)];
+#else
+#define AUTODIFF_HANDLER(name) case Opcode::name:
+#define AUTODIFF_NEXT ++ip; continue
+			for (;;) switch (ip->opcode) {
+#endif
+			AUTODIFF_HANDLER(Constant) r[ip->dst] = k[ip->a]; AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Input) r[ip->dst] = inputs[ip->a]; AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Add) r[ip->dst] = r[ip->a] + r[ip->b]; AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Subtract) r[ip->dst] = r[ip->a] - r[ip->b]; AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Multiply) r[ip->dst] = r[ip->a] * r[ip->b]; AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Divide) r[ip->dst] = r[ip->a] / r[ip->b]; AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Exp) r[ip->dst] = elementary::value<elementary::Function::Exp>(r[ip->a]); AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Log) r[ip->dst] = elementary::value<elementary::Function::Log>(r[ip->a]); AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Sin) r[ip->dst] = elementary::value<elementary::Function::Sin>(r[ip->a]); AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Cos) r[ip->dst] = elementary::value<elementary::Function::Cos>(r[ip->a]); AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Sqrt) r[ip->dst] = elementary::value<elementary::Function::Sqrt>(r[ip->a]); AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Pow) r[ip->dst] = elementary::pow(r[ip->a], k[ip->b]); AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Output) outputs[ip->dst] = r[ip->a]; AUTODIFF_NEXT;
+			AUTODIFF_HANDLER(Halt) return;
+#if !(defined(__GNUC__) || defined(__clang__))
+			}
+#endif
+#undef AUTODIFF_HANDLER
+#undef AUTODIFF_NEXT
+		}
+
+		std::span<const Instruction> instructions() const { return code; }
+		std::span<const Scalar> constantPool() const { return constants; }
+		std::size_t registerCount() const { return registers.size(); }
+		std::size_t outputs() const { return outputCount; }
+
+	private:
+		static std::uint16_t narrow(std::size_t operand) {
+			if (operand > std::numeric_limits<std::uint16_t>::max()) throw std::length_error("bytecode operand out of 16-bit range");
+			return static_cast<std::uint16_t>(operand);
+		}
+
+		std::uint16_t constant(Scalar value) {
+			auto found = std::find(constants.begin(), constants.end(), value);
+			if (found != constants.end()) return narrow(found - constants.begin());
+			constants.push_back(value);
+			return narrow(constants.size() - 1);
+		}
+
+		std::vector<Instruction> code;
+		std::vector<Scalar> constants;
+		std::vector<Scalar> registers;
+		std::size_t outputCount = 0;
+	};
+
+	// program computing a multiVarDiff expression followed by its partials - outputs are the value, then
+	// d/dIndexedVariable<i> (or d/dvars[i] for variables bound by address) for every input slot
+	template <typename Scalar, multiVarDiff::ExprType exprType, typename... Ts>
+	Program<Scalar> compileGradient(const multiVarDiff::Expression<Scalar, exprType, Ts...>& expr,
+									const std::same_as<multiVarDiff::BasicVariable<Scalar>> auto&... vars) {
+		graph::Graph<Scalar> lowered = graph::toGraph(expr, vars...);
+		return Program<Scalar>{graph::gradientGraph(lowered, lowered.outputs()[0])};
+	}
+
+	// program computing a singleVarDiff expression and its derivative - outputs are the value, then d/dx
+	template <typename Scalar, singleVarDiff::ExprType exprType, typename... Ts>
+	Program<Scalar> compileGradient(const singleVarDiff::Expression<Scalar, exprType, Ts...>& expr) {
+		graph::Graph<Scalar> lowered = graph::toGraph(expr);
+		return Program<Scalar>{graph::gradientGraph(lowered, lowered.outputs()[0])};
+	}
+
+}
@@ -0,0 +1,183 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include "Graph.h"
+#include "Lowering.h"
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+
+// ahead-of-time C++ for graphs - straight-line inline functions with one local per distinct subexpression, so
+// a model compiles with full optimizer visibility and none of the template instantiations of the headers
+namespace codegen {
+
+	template <typename Scalar>
+	constexpr std::string_view typeName = std::is_same_v<Scalar, float> ? "float" : std::is_same_v<Scalar, double> ? "double" : "long double";
+
+	// shortest spelling that reads back as the same value, e.g. 0.1f, 3.0, 1e+20L
+	template <typename Scalar>
+	std::string literal(Scalar value) {
+		static_assert(std::is_floating_point_v<Scalar>, "code is generated for floating-point scalars");
+		if (!std::isfinite(value)) throw std::invalid_argument("cannot emit a non-finite constant");
+		char buffer[64];
+		std::string text(buffer, std::to_chars(buffer, buffer + sizeof(buffer), value).ptr);
+		if (text.find_first_of(".e") == std::string::npos) text += ".0";
+		if constexpr (std::is_same_v<Scalar, float>) text += 'f';
+		else if constexpr (std::is_same_v<Scalar, long double>) text += 'L';
+		return text;
+	}
+
+	// generated locals and the partials parameter start with this, so user names may not
+	constexpr std::string_view reservedPrefix = "ad_";
+
+	inline constexpr std::array<std::string_view, 96> keywords = {
+		"alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "bool", "break", "case", "catch",
+		"char", "char8_t", "char16_t", "char32_t", "class", "compl", "concept", "const", "consteval", "constexpr",
+		"constinit", "const_cast", "continue", "co_await", "co_return", "co_yield", "decltype", "default", "delete",
+		"do", "double", "dynamic_cast", "else", "enum", "explicit", "export", "extern", "false", "final", "float",
+		"for", "friend", "goto", "if", "import", "inline", "int", "long", "module", "mutable", "namespace", "new",
+		"noexcept", "not", "not_eq", "nullptr", "operator", "or", "or_eq", "override", "private", "protected",
+		"public", "register", "reinterpret_cast", "requires", "return", "short", "signed", "sizeof", "static",
+		"static_assert", "static_cast", "struct", "switch", "template", "this", "thread_local", "throw", "true",
+		"try", "typedef", "typeid", "typename", "union", "unsigned", "using", "virtual", "void", "volatile",
+		"wchar_t", "while", "xor", "xor_eq"};
+
+	// throws std::invalid_argument unless name can be spelled as a function or parameter name in the generated
+	// code: an identifier that is not a keyword, not reserved to the implementation and not under reservedPrefix
+	inline void checkName(std::string_view name) {
+		auto letter = [](char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; };
+		auto digit = [](char c) { return c >= '0' && c <= '9'; };
+		std::string quoted = "'" + std::string(name) + "'";
+		if (name.empty()) throw std::invalid_argument("empty name");
+		if (!letter(name[0]) || !std::all_of(name.begin(), name.end(), [&](char c) { return letter(c) || digit(c); }))
+			throw std::invalid_argument(quoted + " is not an identifier");
+		if (std::find(keywords.begin(), keywords.end(), name) != keywords.end())
+			throw std::invalid_argument(quoted + " is a reserved word");
+		if (name.find("__") != std::string_view::npos || (name[0] == '_' && name.size() > 1 && name[1] >= 'A' && name[1] <= 'Z'))
+			throw std::invalid_argument(quoted + " is reserved to the implementation");
+		if (name.starts_with(reservedPrefix)) throw std::invalid_argument(quoted + " uses the prefix of generated names");
+	}
+
+	// Writes `inline Scalar name(Scalar input0, ...)` returning outputs[0]. Further outputs go to a trailing
+	// `Scalar* ad_partials` parameter, outputs[i] to ad_partials[i - 1]. Only nodes the outputs depend on are
+	// emitted; constants and variables are spelled inline. inputs names the variable slots - every name goes
+	// through checkName, and the inputs must be distinct
+	template <typename Scalar>
+	void emitFunction(std::ostream& out, const graph::Graph<Scalar>& graph, std::span<const graph::NodeId> outputs,
+					  std::string_view name, std::span<const std::string> inputs) {
+		using graph::Op;
+		std::span<const graph::Node<Scalar>> nodes = graph.nodes();
+		if (outputs.empty()) throw std::invalid_argument("a generated function needs at least one output");
+		if (graph.inputCount() > inputs.size()) throw std::invalid_argument("graph reads an input slot without a name");
+		checkName(name);
+		for (std::size_t slot = 0; slot < inputs.size(); ++slot) {
+			checkName(inputs[slot]);
+			if (std::find(inputs.begin(), inputs.begin() + slot, inputs[slot]) != inputs.begin() + slot)
+				throw std::invalid_argument("'" + inputs[slot] + "' names two inputs");
+		}
+		const std::string partials = std::string(reservedPrefix) + "partials";
+
+		std::vector<bool> live(nodes.size());
+		std::vector<bool> used(inputs.size());
+		for (graph::NodeId output : outputs) live[output] = true;
+		for (std::size_t i = nodes.size(); i-- > 0;) {
+			if (!live[i]) continue;
+			const graph::Node<Scalar>& node = nodes[i];
+			if (node.op == Op::Variable) used[node.lhs] = true;
+			if (graph::isBinary(node.op) || graph::isUnary(node.op)) live[node.lhs] = true;
+			if (graph::isBinary(node.op)) live[node.rhs] = true;
+		}
+
+		std::string_view scalar = typeName<Scalar>;
+		out << "inline " << scalar << " " << name << "(";
+		for (std::size_t slot = 0; slot < inputs.size(); ++slot) {
+			out << (slot > 0 ? ", " : "") << (used[slot] ? "" : "[[maybe_unused]] ") << scalar << " " << inputs[slot];
+		}
+		if (outputs.size() > 1) out << (inputs.empty() ? "" : ", ") << scalar << "* " << partials;
+		out << ") {\n";
+
+		// locals are numbered in emission order rather than by node index
+		std::vector<std::string> names(nodes.size());
+		std::size_t locals = 0;
+		for (std::size_t i = 0; i < nodes.size(); ++i) {
+			if (!live[i]) continue;
+			const graph::Node<Scalar>& node = nodes[i];
+			if (node.op == Op::Constant) {
+				names[i] = literal(node.payload);
+				continue;
+			}
+			if (node.op == Op::Variable) {
+				names[i] = inputs[node.lhs];
+				continue;
+			}
+
+			const std::string& a = names[node.lhs];
+			std::string value;
+			switch (node.op) {
+			case Op::Sum: value = a + " + " + names[node.rhs]; break;
+			case Op::Difference: value = a + " - " + names[node.rhs]; break;
+			case Op::Product: value = a + " * " + names[node.rhs]; break;
+			case Op::Quotient: value = a + " / " + names[node.rhs]; break;
+			case Op::Exp: value = "std::exp(" + a + ")"; break;
+			case Op::Log: value = "std::log(" + a + ")"; break;
+			case Op::Sin: value = "std::sin(" + a + ")"; break;
+			case Op::Cos: value = "std::cos(" + a + ")"; break;
+			case Op::Sqrt: value = "std::sqrt(" + a + ")"; break;
+			case Op::Pow: value = "std::pow(" + a + ", " + literal(node.payload) + ")"; break;
+			default: break;
+			}
+			names[i] = std::string(reservedPrefix) + "t" + std::to_string(locals++);
+			out << "\tconst " << scalar << " " << names[i] << " = " << value << ";\n";
+		}
+
+		for (std::size_t output = 1; output < outputs.size(); ++output) {
+			out << "\t" << partials << "[" << output - 1 << "] = " << names[outputs[output]] << ";\n";
+		}
+		out << "\treturn " << names[outputs[0]] << ";\n}\n";
+	}
+
+	// Writes a self-contained header defining name(inputs...), the value of root, and
+	// nameGradient(inputs..., ad_partials), which also stores d root / d inputs[i] to ad_partials[i]. The gradient is
+	// the reverse pass unrolled by graph::gradientGraph, so forward values are shared with the adjoint terms
+	template <typename Scalar>
+	void emitHeader(std::ostream& out, const graph::Graph<Scalar>& source, graph::NodeId root, std::string_view name,
+					std::span<const std::string> inputs) {
+		// named inputs the expression never reads still get a (zero) partial
+		graph::Graph<Scalar> padded = source;
+		for (std::size_t slot = source.inputCount(); slot < inputs.size(); ++slot) padded.variable(static_cast<std::uint32_t>(slot));
+		graph::Graph<Scalar> gradient = graph::gradientGraph(padded, root);
+
+		out << "#pragma once\n#include <cmath>\n\n";
+		graph::NodeId value[] = {root};
+		emitFunction(out, source, value, name, inputs);
+		out << "\n";
+		emitFunction(out, gradient, gradient.outputs(), std::string(name) + "Gradient", inputs);
+	}
+
+	// header for a singleVarDiff expression - nameGradient stores the derivative to ad_partials[0]
+	template <typename Scalar, singleVarDiff::ExprType exprType, typename... Ts>
+	void emitHeader(std::ostream& out, const singleVarDiff::Expression<Scalar, exprType, Ts...>& expr, std::string_view name,
+					const std::string& input = "x") {
+		graph::Graph<Scalar> lowered = graph::toGraph(expr);
+		emitHeader(out, lowered, lowered.outputs()[0], name, std::span<const std::string>{&input, 1});
+	}
+
+	// header for a multiVarDiff expression over IndexedVariables - IndexedVariable<i> is named inputs[i]
+	template <typename Scalar, multiVarDiff::ExprType exprType, typename... Ts>
+	void emitHeader(std::ostream& out, const multiVarDiff::Expression<Scalar, exprType, Ts...>& expr, std::string_view name,
+					std::span<const std::string> inputs) {
+		graph::Graph<Scalar> lowered = graph::toGraph(expr);
+		emitHeader(out, lowered, lowered.outputs()[0], name, inputs);
+	}
+
+}
@@ -0,0 +1,199 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// evaluation that computes structurally identical subtrees once - works on singleVarDiff and multiVarDiff trees
+namespace cse {
+
+	// binary node of either namespace - Expression<Scalar, exprType, LHS, RHS>
+	template <typename T> constexpr bool isComposite = false;
+	template <template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, typename LHS, typename RHS>
+	constexpr bool isComposite<Expression<Scalar, exprType, LHS, RHS>> = true;
+
+	// unary node of either namespace - Expression<Scalar, exprType, Operand> over another expression
+	template <typename T> constexpr bool isUnary = false;
+	template <template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, auto exprType1, typename... Ts1>
+	constexpr bool isUnary<Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>>> = true;
+
+	// precision an expression of either namespace is evaluated in
+	template <typename T> struct ScalarOf;
+	template <template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, typename... Ts>
+	struct ScalarOf<Expression<Scalar, exprType, Ts...>> { using type = Scalar; };
+
+	// number of nodes in a tree, numbered in pre-order
+	template <typename T> constexpr std::size_t nodeCount = 1;
+	template <template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, typename LHS, typename RHS>
+	constexpr std::size_t nodeCount<Expression<Scalar, exprType, LHS, RHS>> = 1 + nodeCount<LHS> + nodeCount<RHS>;
+	template <template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, auto exprType1, typename... Ts1>
+	constexpr std::size_t nodeCount<Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>>> = 1 + nodeCount<Expression<Scalar, exprType1, Ts1...>>;
+
+	// number of nodes of type T in Tree
+	template <typename T, typename Tree> constexpr std::size_t occurrences = std::is_same_v<T, Tree>;
+	template <typename T, template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, typename LHS, typename RHS>
+	constexpr std::size_t occurrences<T, Expression<Scalar, exprType, LHS, RHS>> =
+		std::is_same_v<T, Expression<Scalar, exprType, LHS, RHS>> + occurrences<T, LHS> + occurrences<T, RHS>;
+	template <typename T, template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, auto exprType1, typename... Ts1>
+	constexpr std::size_t occurrences<T, Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>>> =
+		std::is_same_v<T, Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>>> + occurrences<T, Expression<Scalar, exprType1, Ts1...>>;
+
+	// number of interior nodes in Subtree whose type occurs more than once in Tree - bounds the scratch slots
+	template <typename Tree, typename Subtree> constexpr std::size_t repeatedNodes = 0;
+	template <typename Tree, template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, typename LHS, typename RHS>
+	constexpr std::size_t repeatedNodes<Tree, Expression<Scalar, exprType, LHS, RHS>> =
+		(occurrences<Expression<Scalar, exprType, LHS, RHS>, Tree> > 1) + repeatedNodes<Tree, LHS> + repeatedNodes<Tree, RHS>;
+	template <typename Tree, template <typename, auto, typename...> class Expression, typename Scalar, auto exprType, auto exprType1, typename... Ts1>
+	constexpr std::size_t repeatedNodes<Tree, Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>>> =
+		(occurrences<Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>>, Tree> > 1) + repeatedNodes<Tree, Expression<Scalar, exprType1, Ts1...>>;
+
+	// whether a tree holds runtime data (constant values, variable identities, exponents) - without it, equal types mean equal trees
+	template <typename Node>
+	consteval bool carriesData() {
+		if constexpr (isComposite<Node>) return carriesData<decltype(Node::lhs)>() || carriesData<decltype(Node::rhs)>();
+		else if constexpr (isUnary<Node>) return requires { &Node::exponent; } || carriesData<decltype(Node::operand)>();
+		else return !std::is_empty_v<Node>;
+	}
+
+	// pre-order position of the first node of type T in Tree, or nodeCount<Tree> if there is none
+	template <typename T, typename Tree>
+	consteval std::size_t firstPosition() {
+		if constexpr (std::is_same_v<T, Tree>) return 0;
+		else if constexpr (isComposite<Tree>) {
+			using LHS = decltype(Tree::lhs);
+			using RHS = decltype(Tree::rhs);
+			if constexpr (occurrences<T, LHS> > 0) return 1 + firstPosition<T, LHS>();
+			else return 1 + nodeCount<LHS> + firstPosition<T, RHS>();
+		}
+		else if constexpr (isUnary<Tree>) return 1 + firstPosition<T, decltype(Tree::operand)>();
+		else return 1;
+	}
+
+	// equal types and equal runtime data (constant values, variable identities, exponents, erased graphs)
+	template <typename Node>
+	constexpr bool sameStructure(const Node& a, const Node& b) {
+		if constexpr (isComposite<Node>) return sameStructure(a.lhs, b.lhs) && sameStructure(a.rhs, b.rhs);
+		else if constexpr (isUnary<Node> && requires { a.exponent; }) return a.exponent == b.exponent && sameStructure(a.operand, b.operand);
+		else if constexpr (isUnary<Node>) return sameStructure(a.operand, b.operand);
+		else if constexpr (requires { a.initAddress; }) return a.initAddress == b.initAddress;
+		// erased nodes of one type can hold different graphs - the same graph and root, bound to the same variables
+		else if constexpr (requires { a.graph; a.root; }) {
+			if (a.graph != b.graph || a.root != b.root) return false;
+			if constexpr (requires { a.bound; }) {
+				if (a.bound.size() != b.bound.size()) return false;
+				for (std::size_t k = 0; k < a.bound.size(); ++k) {
+					if (a.bound[k].initAddress != b.bound[k].initAddress) return false;
+				}
+			}
+			return true;
+		}
+		else if constexpr (requires { a.value; }) return a.value == b.value;
+		else return true;
+	}
+
+	// Evaluates an expression so each set of structurally identical subtrees is computed once per call.
+	// Subtrees without runtime data are shared by type alone, entirely at compile time; the rest are matched
+	// once at construction. Shared values live in a stack scratch array for the duration of a call
+	template <typename Expr>
+	class SharedEvaluator {
+	public:
+		using Scalar = typename ScalarOf<Expr>::type;
+
+		explicit SharedEvaluator(const Expr& expr) : expr(expr) {
+			std::array<Representative, slotCapacity> representatives{};
+			plan<0>(this->expr, representatives);
+		}
+
+		Scalar operator()(const auto&... args) const {
+			std::array<Scalar, slotCapacity> scratch;
+			return evaluate<0>(expr, scratch, args...);
+		}
+
+		// number of distinct repeated subtrees that are computed once and reused
+		std::size_t sharedCount() const { return slotCount; }
+
+	private:
+		static constexpr std::size_t nodes = nodeCount<Expr>;
+		static constexpr std::size_t slotCapacity = repeatedNodes<Expr, Expr>;
+
+		enum class Action : std::uint8_t { Evaluate, Store, Load };
+
+		// first occurrence of a shared subtree - type tag plus the node it was seen at
+		struct Representative {
+			const void* type;
+			const void* node;
+		};
+
+		template <typename T> static constexpr char typeTag = 0;
+
+		template <std::size_t position, typename Node>
+		void plan(const Node& node, std::array<Representative, slotCapacity>& representatives) {
+			if constexpr (isComposite<Node> || isUnary<Node>) {
+				if constexpr (occurrences<Node, Expr> > 1) {
+					for (std::size_t slot = 0; slot < slotCount; ++slot) {
+						if (representatives[slot].type == &typeTag<Node> &&
+							sameStructure(*static_cast<const Node*>(representatives[slot].node), node)) {
+							// an earlier copy is always evaluated first, so this subtree is never entered
+							actions[position] = Action::Load;
+							slots[position] = static_cast<std::uint32_t>(slot);
+							return;
+						}
+					}
+					actions[position] = Action::Store;
+					slots[position] = static_cast<std::uint32_t>(slotCount);
+					representatives[slotCount++] = {&typeTag<Node>, &node};
+				}
+				if constexpr (isUnary<Node>) {
+					plan<position + 1>(node.operand, representatives);
+				}
+				else {
+					plan<position + 1>(node.lhs, representatives);
+					plan<position + 1 + nodeCount<decltype(node.lhs)>>(node.rhs, representatives);
+				}
+			}
+		}
+
+		template <std::size_t position, typename Node>
+		Scalar evaluate(const Node& node, std::array<Scalar, slotCapacity>& scratch, const auto&... args) const {
+			if constexpr (isComposite<Node> || isUnary<Node>) {
+				constexpr bool shared = occurrences<Node, Expr> > 1;
+				constexpr bool firstCopy = position == firstPosition<Node, Expr>();
+
+				if constexpr (shared && !carriesData<Node>()) {
+					if constexpr (!firstCopy) return scratch[slots[position]];
+				}
+				else if constexpr (shared) {
+					if (actions[position] == Action::Load) return scratch[slots[position]];
+				}
+
+				// operands in pre-order, so the first copy of a shared subtree is stored before it is loaded
+				Scalar value;
+				if constexpr (isUnary<Node>) {
+					value = node.apply(evaluate<position + 1>(node.operand, scratch, args...));
+				}
+				else {
+					Scalar lhs = evaluate<position + 1>(node.lhs, scratch, args...);
+					Scalar rhs = evaluate<position + 1 + nodeCount<decltype(node.lhs)>>(node.rhs, scratch, args...);
+					value = Node::apply(lhs, rhs);
+				}
+
+				if constexpr (shared && !carriesData<Node>()) {
+					if constexpr (firstCopy) scratch[slots[position]] = value;
+				}
+				else if constexpr (shared) {
+					if (actions[position] == Action::Store) scratch[slots[position]] = value;
+				}
+				return value;
+			}
+			else {
+				return node(args...);
+			}
+		}
+
+		Expr expr;
+		std::array<Action, nodes> actions{};
+		std::array<std::uint32_t, nodes> slots{};
+		std::size_t slotCount = 0;
+	};
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+
+// elementary function kernels shared by both differentiation namespaces. Unqualified calls find std:: for
+// scalars and simd:: for vector lanes
+namespace elementary {
+
+	enum class Function : std::uint8_t {
+		Exp,
+		Log,
+		Sin,
+		Cos,
+		Sqrt
+	};
+
+	// f(u) together with f'(u) - the slope is derived from the value wherever the two share work
+	template <typename T>
+	struct ValueSlope {
+		T value;
+		T slope;
+	};
+
+	template <Function function, typename T>
+	constexpr T value(const T& u) {
+		using std::exp, std::log, std::sin, std::cos, std::sqrt;
+
+		if constexpr (function == Function::Exp) return exp(u);
+		else if constexpr (function == Function::Log) return log(u);
+		else if constexpr (function == Function::Sin) return sin(u);
+		else if constexpr (function == Function::Cos) return cos(u);
+		else return sqrt(u);
+	}
+
+	template <Function function, typename T>
+	constexpr ValueSlope<T> valueSlope(const T& u) {
+		using std::exp, std::log, std::sin, std::cos, std::sqrt;
+
+		if constexpr (function == Function::Exp) {
+			T e = exp(u);
+			return {e, e};
+		}
+		else if constexpr (function == Function::Log) return {log(u), T(1) / u};
+		// sin and cos of one argument next to each other are merged into a single sincos call
+		else if constexpr (function == Function::Sin) return {sin(u), cos(u)};
+		else if constexpr (function == Function::Cos) return {cos(u), -sin(u)};
+		else {
+			T root = sqrt(u);
+			return {root, T(0.5) / root};
+		}
+	}
+
+	template <typename T>
+	constexpr T pow(const T& u, std::type_identity_t<T> exponent) {
+		using std::pow;
+		return pow(u, exponent);
+	}
+
+	// u^p and p*u^(p-1) - the slope is not taken as p*value/u so it stays finite at u = 0
+	template <typename T, typename Exponent>
+	constexpr ValueSlope<T> powValueSlope(const T& u, const Exponent& exponent) {
+		using std::pow;
+		return {pow(u, exponent), exponent * pow(u, exponent - Exponent(1))};
+	}
+
+}
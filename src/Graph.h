@@ -0,0 +1,329 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "Elementary.h"
+
+// runtime expression graph - for models whose structure is only known at run time, e.g. loaded from a config
+namespace graph {
+
+	// mirrors ExprType of singleVarDiff / multiVarDiff
+	enum class Op : std::uint8_t {
+		Constant,
+		Variable,
+		Sum,
+		Difference,
+		Product,
+		Quotient,
+		Exp,
+		Log,
+		Sin,
+		Cos,
+		Sqrt,
+		Pow
+	};
+
+	using NodeId = std::uint32_t;
+
+	constexpr bool isBinary(Op op) { return op >= Op::Sum && op <= Op::Quotient; }
+	constexpr bool isUnary(Op op) { return op >= Op::Exp; }
+
+	// both ExprTypes list their node kinds in the order of Op
+	template <typename ExprType>
+	constexpr Op opOf(ExprType exprType) { return static_cast<Op>(static_cast<std::uint8_t>(exprType)); }
+
+	// One node of the graph. Operands are indices of earlier nodes, so the node array is always in topological order.
+	// lhs is the input slot of a Variable and the operand of a unary op; payload is the value of a Constant and the
+	// exponent of a Pow
+	template <typename Scalar>
+	struct Node {
+		Op op;
+		NodeId lhs;
+		NodeId rhs;
+		Scalar payload;
+	};
+
+	// f'(u) of a unary node, reusing its value f(u) where the derivative is built from it
+	template <typename Scalar>
+	Scalar slope(const Node<Scalar>& node, Scalar u, Scalar value) {
+		switch (node.op) {
+		case Op::Exp: return value;
+		case Op::Log: return Scalar(1) / u;
+		case Op::Sin: return elementary::value<elementary::Function::Cos>(u);
+		case Op::Cos: return -elementary::value<elementary::Function::Sin>(u);
+		case Op::Sqrt: return Scalar(0.5) / value;
+		case Op::Pow: return node.payload * elementary::pow(u, node.payload - Scalar(1));
+		default: return 0;
+		}
+	}
+
+	// Flat expression graph. Nodes live in one contiguous array and refer to each other by index, so passes over
+	// graphs of 10^5+ nodes are linear scans. Nodes are hash-consed: building a node equal to an existing one
+	// (same op, operands and payload, with the operands of sums and products in canonical order) returns the
+	// existing index, so every distinct subexpression is stored and evaluated once.
+	// Buffers named values / tangents / adjoints hold one entry per node
+	template <typename Scalar>
+	class Graph {
+	public:
+		NodeId constant(Scalar value) { return push({Op::Constant, 0, 0, value}); }
+		// reads inputs[slot] at evaluation
+		NodeId variable(std::uint32_t slot) { return push({Op::Variable, slot, 0, 0}); }
+
+		NodeId sum(NodeId lhs, NodeId rhs) { return push({Op::Sum, lhs, rhs, 0}); }
+		NodeId difference(NodeId lhs, NodeId rhs) { return push({Op::Difference, lhs, rhs, 0}); }
+		NodeId product(NodeId lhs, NodeId rhs) { return push({Op::Product, lhs, rhs, 0}); }
+		NodeId quotient(NodeId lhs, NodeId rhs) { return push({Op::Quotient, lhs, rhs, 0}); }
+
+		NodeId exp(NodeId operand) { return push({Op::Exp, operand, 0, 0}); }
+		NodeId log(NodeId operand) { return push({Op::Log, operand, 0, 0}); }
+		NodeId sin(NodeId operand) { return push({Op::Sin, operand, 0, 0}); }
+		NodeId cos(NodeId operand) { return push({Op::Cos, operand, 0, 0}); }
+		NodeId sqrt(NodeId operand) { return push({Op::Sqrt, operand, 0, 0}); }
+		NodeId pow(NodeId base, Scalar exponent) { return push({Op::Pow, base, 0, exponent}); }
+
+		// node of any op, checked - for graphs read from a model description. Throws std::invalid_argument
+		// when an operand does not refer to an earlier node
+		NodeId add(Op op, NodeId lhs = 0, NodeId rhs = 0, Scalar payload = 0) {
+			bool valid = op <= Op::Pow;
+			if (isBinary(op)) valid = valid && lhs < nodeArray.size() && rhs < nodeArray.size();
+			else if (isUnary(op)) valid = valid && lhs < nodeArray.size();
+			if (!valid) throw std::invalid_argument("graph node refers to a missing operand");
+			return push({op, isBinary(op) || isUnary(op) || op == Op::Variable ? lhs : 0, isBinary(op) ? rhs : 0, payload});
+		}
+
+		// copies the nodes root depends on from source, with inputNodes[slot] standing in for each variable of
+		// source, and returns the copy of root - nodes already present are shared
+		NodeId append(const Graph& source, NodeId root, std::span<const NodeId> inputNodes) {
+			std::span<const Node<Scalar>> nodes = source.nodes();
+			std::vector<bool> live(root + 1);
+			live[root] = true;
+			for (std::size_t i = root + 1; i-- > 0;) {
+				if (!live[i]) continue;
+				if (isBinary(nodes[i].op) || isUnary(nodes[i].op)) live[nodes[i].lhs] = true;
+				if (isBinary(nodes[i].op)) live[nodes[i].rhs] = true;
+			}
+
+			std::vector<NodeId> copies(root + 1);
+			for (std::size_t i = 0; i <= root; ++i) {
+				if (!live[i]) continue;
+				Node<Scalar> node = nodes[i];
+				if (node.op == Op::Variable) {
+					copies[i] = inputNodes[node.lhs];
+					continue;
+				}
+				if (isBinary(node.op) || isUnary(node.op)) node.lhs = copies[node.lhs];
+				if (isBinary(node.op)) node.rhs = copies[node.rhs];
+				copies[i] = push(node);
+			}
+			return copies[root];
+		}
+
+		// marks a node as a result - used by code generated from the graph
+		void addOutput(NodeId node) { outputList.push_back(node); }
+
+		std::span<const Node<Scalar>> nodes() const { return nodeArray; }
+		std::span<const NodeId> outputs() const { return outputList; }
+		std::size_t size() const { return nodeArray.size(); }
+		// one past the highest variable slot
+		std::size_t inputCount() const { return inputs; }
+
+		// values[i] receives the value of node i
+		void evaluate(std::span<const Scalar> inputs, std::span<Scalar> values) const {
+			for (std::size_t i = 0; i < nodeArray.size(); ++i) {
+				const Node<Scalar>& node = nodeArray[i];
+				values[i] = apply(node, inputs, values);
+			}
+		}
+
+		// forward mode - tangents[i] receives the derivative of node i along direction (one entry per input slot)
+		void derivative(std::span<const Scalar> inputs, std::span<const Scalar> direction,
+						std::span<Scalar> values, std::span<Scalar> tangents) const {
+			for (std::size_t i = 0; i < nodeArray.size(); ++i) {
+				const Node<Scalar>& node = nodeArray[i];
+				values[i] = apply(node, inputs, values);
+
+				switch (node.op) {
+				case Op::Constant: tangents[i] = 0; break;
+				case Op::Variable: tangents[i] = direction[node.lhs]; break;
+				case Op::Sum: tangents[i] = tangents[node.lhs] + tangents[node.rhs]; break;
+				case Op::Difference: tangents[i] = tangents[node.lhs] - tangents[node.rhs]; break;
+				case Op::Product: tangents[i] = tangents[node.lhs] * values[node.rhs] + values[node.lhs] * tangents[node.rhs]; break;
+				case Op::Quotient: tangents[i] = (tangents[node.lhs] - values[i] * tangents[node.rhs]) / values[node.rhs]; break;
+				default: tangents[i] = slope(node, values[node.lhs], values[i]) * tangents[node.lhs]; break;
+				}
+			}
+		}
+
+		// reverse mode - partials[slot] receives d root / d inputs[slot]. values must come from evaluate();
+		// adjoints is scratch for the nodes up to root
+		void gradient(NodeId root, std::span<const Scalar> values, std::span<Scalar> adjoints, std::span<Scalar> partials) const {
+			std::fill(adjoints.begin(), adjoints.begin() + root + 1, Scalar(0));
+			std::fill(partials.begin(), partials.end(), Scalar(0));
+			adjoints[root] = 1;
+
+			for (std::size_t i = root + 1; i-- > 0;) {
+				const Node<Scalar>& node = nodeArray[i];
+				Scalar adjoint = adjoints[i];
+				if (adjoint == 0) continue;
+
+				switch (node.op) {
+				case Op::Constant: break;
+				case Op::Variable: partials[node.lhs] += adjoint; break;
+				case Op::Sum:
+					adjoints[node.lhs] += adjoint;
+					adjoints[node.rhs] += adjoint;
+					break;
+				case Op::Difference:
+					adjoints[node.lhs] += adjoint;
+					adjoints[node.rhs] -= adjoint;
+					break;
+				case Op::Product:
+					adjoints[node.lhs] += adjoint * values[node.rhs];
+					adjoints[node.rhs] += adjoint * values[node.lhs];
+					break;
+				case Op::Quotient:
+					adjoints[node.lhs] += adjoint / values[node.rhs];
+					adjoints[node.rhs] -= adjoint * values[i] / values[node.rhs];
+					break;
+				default: adjoints[node.lhs] += adjoint * slope(node, values[node.lhs], values[i]); break;
+				}
+			}
+		}
+
+	private:
+		NodeId push(Node<Scalar> node) {
+			// addition and multiplication commute exactly, so a + b and b + a share a node
+			if ((node.op == Op::Sum || node.op == Op::Product) && node.rhs < node.lhs) std::swap(node.lhs, node.rhs);
+
+			auto [existing, inserted] = interned.try_emplace(node, static_cast<NodeId>(nodeArray.size()));
+			if (!inserted) return existing->second;
+
+			if (node.op == Op::Variable) inputs = std::max<std::size_t>(inputs, node.lhs + 1);
+			nodeArray.push_back(node);
+			return existing->second;
+		}
+
+		struct NodeHash {
+			std::size_t operator()(const Node<Scalar>& node) const {
+				std::size_t hash = std::hash<Scalar>{}(node.payload);
+				for (std::size_t part : {std::size_t(node.op), std::size_t(node.lhs), std::size_t(node.rhs)}) {
+					hash ^= part + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+				}
+				return hash;
+			}
+		};
+
+		struct NodeEqual {
+			bool operator()(const Node<Scalar>& a, const Node<Scalar>& b) const {
+				return a.op == b.op && a.lhs == b.lhs && a.rhs == b.rhs && a.payload == b.payload;
+			}
+		};
+
+		static Scalar apply(const Node<Scalar>& node, std::span<const Scalar> inputs, std::span<const Scalar> values) {
+			switch (node.op) {
+			case Op::Constant: return node.payload;
+			case Op::Variable: return inputs[node.lhs];
+			case Op::Sum: return values[node.lhs] + values[node.rhs];
+			case Op::Difference: return values[node.lhs] - values[node.rhs];
+			case Op::Product: return values[node.lhs] * values[node.rhs];
+			case Op::Quotient: return values[node.lhs] / values[node.rhs];
+			case Op::Exp: return elementary::value<elementary::Function::Exp>(values[node.lhs]);
+			case Op::Log: return elementary::value<elementary::Function::Log>(values[node.lhs]);
+			case Op::Sin: return elementary::value<elementary::Function::Sin>(values[node.lhs]);
+			case Op::Cos: return elementary::value<elementary::Function::Cos>(values[node.lhs]);
+			case Op::Sqrt: return elementary::value<elementary::Function::Sqrt>(values[node.lhs]);
+			case Op::Pow: return elementary::pow(values[node.lhs], node.payload);
+			}
+			return 0;
+		}
+
+		std::vector<Node<Scalar>> nodeArray;
+		std::vector<NodeId> outputList;
+		std::unordered_map<Node<Scalar>, NodeId, NodeHash, NodeEqual> interned;
+		std::size_t inputs = 0;
+	};
+
+	// Graph whose outputs are root followed by d root / d inputs[slot] for every input slot. The adjoint pass is
+	// unrolled into ordinary nodes, so anything that evaluates graphs also evaluates reverse-mode gradients, and
+	// hash-consing lets the adjoint nodes share the forward values they read
+	template <typename Scalar>
+	Graph<Scalar> gradientGraph(const Graph<Scalar>& source, NodeId root) {
+		constexpr NodeId none = std::numeric_limits<NodeId>::max();
+		std::span<const Node<Scalar>> nodes = source.nodes();
+
+		Graph<Scalar> graph;
+		std::vector<NodeId> copies(root + 1);
+		for (NodeId i = 0; i <= root; ++i) {
+			const Node<Scalar>& node = nodes[i];
+			NodeId lhs = isBinary(node.op) || isUnary(node.op) ? copies[node.lhs] : node.lhs;
+			NodeId rhs = isBinary(node.op) ? copies[node.rhs] : node.rhs;
+			copies[i] = graph.add(node.op, lhs, rhs, node.payload);
+		}
+
+		auto isOne = [&](NodeId id) { return graph.nodes()[id].op == Op::Constant && graph.nodes()[id].payload == Scalar(1); };
+		auto scale = [&](NodeId adjoint, NodeId factor) {
+			if (isOne(adjoint)) return factor;
+			if (isOne(factor)) return adjoint;
+			return graph.product(adjoint, factor);
+		};
+		auto accumulate = [&](NodeId& total, NodeId contribution) {
+			total = total == none ? contribution : graph.sum(total, contribution);
+		};
+		auto subtract = [&](NodeId& total, NodeId contribution) {
+			total = graph.difference(total == none ? graph.constant(0) : total, contribution);
+		};
+
+		std::vector<NodeId> adjoints(root + 1, none);
+		std::vector<NodeId> partials(source.inputCount(), none);
+		adjoints[root] = graph.constant(1);
+
+		for (NodeId i = root + 1; i-- > 0;) {
+			const Node<Scalar>& node = nodes[i];
+			NodeId adjoint = adjoints[i];
+			if (adjoint == none) continue;
+
+			NodeId lhs = isBinary(node.op) || isUnary(node.op) ? copies[node.lhs] : none;
+			NodeId rhs = isBinary(node.op) ? copies[node.rhs] : none;
+			switch (node.op) {
+			case Op::Constant: break;
+			case Op::Variable: accumulate(partials[node.lhs], adjoint); break;
+			case Op::Sum:
+				accumulate(adjoints[node.lhs], adjoint);
+				accumulate(adjoints[node.rhs], adjoint);
+				break;
+			case Op::Difference:
+				accumulate(adjoints[node.lhs], adjoint);
+				subtract(adjoints[node.rhs], adjoint);
+				break;
+			case Op::Product:
+				accumulate(adjoints[node.lhs], scale(adjoint, rhs));
+				accumulate(adjoints[node.rhs], scale(adjoint, lhs));
+				break;
+			case Op::Quotient:
+				accumulate(adjoints[node.lhs], graph.quotient(adjoint, rhs));
+				subtract(adjoints[node.rhs], graph.quotient(scale(adjoint, copies[i]), rhs));
+				break;
+			case Op::Exp: accumulate(adjoints[node.lhs], scale(adjoint, copies[i])); break;
+			case Op::Log: accumulate(adjoints[node.lhs], graph.quotient(adjoint, lhs)); break;
+			case Op::Sin: accumulate(adjoints[node.lhs], scale(adjoint, graph.cos(lhs))); break;
+			case Op::Cos: subtract(adjoints[node.lhs], scale(adjoint, graph.sin(lhs))); break;
+			case Op::Sqrt: accumulate(adjoints[node.lhs], graph.quotient(scale(adjoint, graph.constant(Scalar(0.5))), copies[i])); break;
+			case Op::Pow:
+				accumulate(adjoints[node.lhs], scale(adjoint, graph.product(graph.constant(node.payload), graph.pow(lhs, node.payload - Scalar(1)))));
+				break;
+			}
+		}
+
+		graph.addOutput(copies[root]);
+		for (NodeId partial : partials) graph.addOutput(partial == none ? graph.constant(0) : partial);
+		return graph;
+	}
+
+}
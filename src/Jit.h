@@ -0,0 +1,350 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "Bytecode.h"
+#include "Elementary.h"
+#include "Lowering.h"
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define AUTODIFF_JIT_X86_64 1
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#else
+#define AUTODIFF_JIT_X86_64 0
+#endif
+
+// native code for hot expressions - bytecode programs are translated into x86-64 SSE machine code in executable
+// memory, with no external compiler. Where no code can be emitted (another architecture, a Scalar other than
+// float/double, or a platform that refuses executable pages) the compiled objects evaluate the expression itself
+namespace jit {
+
+	// whether this build targets a CPU the emitter knows - SSE2 is part of x86-64, so no runtime check is needed
+	constexpr bool supported = AUTODIFF_JIT_X86_64;
+
+	// page-granular buffer that is written once and then flipped to read + execute
+	class ExecutableMemory {
+	public:
+		ExecutableMemory() = default;
+		explicit ExecutableMemory(std::span<const std::uint8_t> code) {
+#if AUTODIFF_JIT_X86_64
+#if defined(_WIN32)
+			void* memory = VirtualAlloc(nullptr, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+			if (memory == nullptr) return;
+			std::memcpy(memory, code.data(), code.size());
+			DWORD previous;
+			if (!VirtualProtect(memory, code.size(), PAGE_EXECUTE_READ, &previous)) {
+				VirtualFree(memory, 0, MEM_RELEASE);
+				return;
+			}
+			FlushInstructionCache(GetCurrentProcess(), memory, code.size());
+#else
+			void* memory = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (memory == MAP_FAILED) return;
+			std::memcpy(memory, code.data(), code.size());
+			if (mprotect(memory, code.size(), PROT_READ | PROT_EXEC) != 0) {
+				munmap(memory, code.size());
+				return;
+			}
+#endif
+			data = memory;
+			size = code.size();
+#endif
+		}
+
+		ExecutableMemory(ExecutableMemory&& other) noexcept
+			: data(std::exchange(other.data, nullptr)), size(std::exchange(other.size, 0)) {}
+
+		ExecutableMemory& operator=(ExecutableMemory&& other) noexcept {
+			if (this != &other) {
+				release();
+				data = std::exchange(other.data, nullptr);
+				size = std::exchange(other.size, 0);
+			}
+			return *this;
+		}
+
+		~ExecutableMemory() { release(); }
+
+		const void* get() const { return data; }
+		explicit operator bool() const { return data != nullptr; }
+
+	private:
+		void release() {
+#if AUTODIFF_JIT_X86_64
+			if (data == nullptr) return;
+#if defined(_WIN32)
+			VirtualFree(data, 0, MEM_RELEASE);
+#else
+			munmap(data, size);
+#endif
+			data = nullptr;
+#endif
+		}
+
+		void* data = nullptr;
+		std::size_t size = 0;
+	};
+
+	// Machine code for a bytecode::Program. The emitted function keeps the register file in memory and works on
+	// xmm0/xmm1 - straight-line code with no dispatch, and transcendentals call the same elementary kernels as
+	// the interpreter so results match it bit for bit. Calls write into the object's register file - use one
+	// NativeProgram per thread
+	template <typename Scalar>
+	class NativeProgram {
+	public:
+		explicit NativeProgram(const bytecode::Program<Scalar>& program)
+			: constants(program.constantPool().begin(), program.constantPool().end()),
+			  registers(program.registerCount()), outputCount(program.outputs()) {
+			if constexpr (supported && (std::same_as<Scalar, float> || std::same_as<Scalar, double>)) {
+				memory = ExecutableMemory{assemble(program.instructions())};
+			}
+		}
+
+		// false when no native code exists and calls must go elsewhere
+		explicit operator bool() const { return static_cast<bool>(memory); }
+
+		// evaluates the program's outputs at inputs - only valid when the object converts to true
+		void operator()(std::span<const Scalar> inputs, std::span<Scalar> outputs) {
+			reinterpret_cast<Entry>(memory.get())(inputs.data(), outputs.data(), registers.data(), constants.data());
+		}
+
+		std::size_t outputs() const { return outputCount; }
+
+	private:
+		using Entry = void (*)(const Scalar* inputs, Scalar* outputs, Scalar* registers, const Scalar* constants);
+
+		// base registers of the four arrays - callee-saved under both the System V and the Windows x64 ABI
+		enum Base : std::uint8_t {
+			Registers = 3,	// rbx
+			Inputs = 12,	// r12
+			Outputs = 13,	// r13
+			Constants = 14	// r14
+		};
+
+		static constexpr std::uint8_t movLoad = 0x10;
+		static constexpr std::uint8_t movStore = 0x11;
+		static constexpr std::uint8_t sqrtOp = 0x51;
+		static constexpr std::uint8_t addOp = 0x58;
+		static constexpr std::uint8_t mulOp = 0x59;
+		static constexpr std::uint8_t subOp = 0x5C;
+		static constexpr std::uint8_t divOp = 0x5E;
+
+		template <elementary::Function function>
+		static Scalar call(Scalar u) { return elementary::value<function>(u); }
+
+		static Scalar callPow(Scalar u, Scalar exponent) { return elementary::pow(u, exponent); }
+
+		struct Assembler {
+			std::vector<std::uint8_t> bytes;
+
+			void emit(std::initializer_list<std::uint8_t> code) { bytes.insert(bytes.end(), code); }
+
+			void emitLittleEndian(std::uint64_t value, int width) {
+				for (int i = 0; i < width; ++i) bytes.push_back(static_cast<std::uint8_t>(value >> (8 * i)));
+			}
+
+			// movss/addss/... xmm, [base + index * sizeof(Scalar)] (or the store form for movStore)
+			void sse(std::uint8_t opcode, int xmm, Base base, std::size_t index) {
+				bytes.push_back(std::same_as<Scalar, float> ? 0xF3 : 0xF2);
+				if (base >= 8) bytes.push_back(0x41);
+				emit({0x0F, opcode, static_cast<std::uint8_t>(0x80 | (xmm << 3) | (base & 7))});
+				// r12 shares its low bits with the SIB escape
+				if ((base & 7) == 4) bytes.push_back(0x24);
+				emitLittleEndian(index * sizeof(Scalar), 4);
+			}
+
+			// mov rax, function; call rax
+			void call(const void* function) {
+				emit({0x48, 0xB8});
+				emitLittleEndian(reinterpret_cast<std::uintptr_t>(function), 8);
+				emit({0xFF, 0xD0});
+			}
+		};
+
+		static std::vector<std::uint8_t> assemble(std::span<const bytecode::Instruction> code) {
+			using bytecode::Opcode;
+			using elementary::Function;
+			Assembler out;
+
+			// push rbx, r12, r13, r14; sub rsp, 40 - realigns the stack to 16 bytes for calls and reserves the
+			// Windows shadow space
+			out.emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x48, 0x83, 0xEC, 0x28});
+#if defined(_WIN32)
+			// mov r12, rcx; mov r13, rdx; mov rbx, r8; mov r14, r9
+			out.emit({0x49, 0x89, 0xCC, 0x49, 0x89, 0xD5, 0x4C, 0x89, 0xC3, 0x4D, 0x89, 0xCE});
+#else
+			// mov r12, rdi; mov r13, rsi; mov rbx, rdx; mov r14, rcx
+			out.emit({0x49, 0x89, 0xFC, 0x49, 0x89, 0xF5, 0x48, 0x89, 0xD3, 0x49, 0x89, 0xCE});
+#endif
+
+			auto binary = [&](const bytecode::Instruction& instruction, std::uint8_t opcode) {
+				out.sse(movLoad, 0, Registers, instruction.a);
+				out.sse(opcode, 0, Registers, instruction.b);
+				out.sse(movStore, 0, Registers, instruction.dst);
+			};
+			auto unary = [&](const bytecode::Instruction& instruction, Scalar (*function)(Scalar)) {
+				out.sse(movLoad, 0, Registers, instruction.a);
+				out.call(reinterpret_cast<const void*>(function));
+				out.sse(movStore, 0, Registers, instruction.dst);
+			};
+
+			for (const bytecode::Instruction& instruction : code) {
+				switch (instruction.opcode) {
+				case Opcode::Constant:
+					out.sse(movLoad, 0, Constants, instruction.a);
+					out.sse(movStore, 0, Registers, instruction.dst);
+					break;
+				case Opcode::Input:
+					out.sse(movLoad, 0, Inputs, instruction.a);
+					out.sse(movStore, 0, Registers, instruction.dst);
+					break;
+				case Opcode::Add: binary(instruction, addOp); break;
+				case Opcode::Subtract: binary(instruction, subOp); break;
+				case Opcode::Multiply: binary(instruction, mulOp); break;
+				case Opcode::Divide: binary(instruction, divOp); break;
+				case Opcode::Exp: unary(instruction, &call<Function::Exp>); break;
+				case Opcode::Log: unary(instruction, &call<Function::Log>); break;
+				case Opcode::Sin: unary(instruction, &call<Function::Sin>); break;
+				case Opcode::Cos: unary(instruction, &call<Function::Cos>); break;
+				// sqrt is correctly rounded in hardware, so it needs no call
+				case Opcode::Sqrt:
+					out.sse(sqrtOp, 0, Registers, instruction.a);
+					out.sse(movStore, 0, Registers, instruction.dst);
+					break;
+				case Opcode::Pow:
+					out.sse(movLoad, 0, Registers, instruction.a);
+					out.sse(movLoad, 1, Constants, instruction.b);
+					out.call(reinterpret_cast<const void*>(&callPow));
+					out.sse(movStore, 0, Registers, instruction.dst);
+					break;
+				case Opcode::Output:
+					out.sse(movLoad, 0, Registers, instruction.a);
+					out.sse(movStore, 0, Outputs, instruction.dst);
+					break;
+				case Opcode::Halt:
+					// add rsp, 40; pop r14, r13, r12, rbx; ret
+					out.emit({0x48, 0x83, 0xC4, 0x28, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+					break;
+				}
+			}
+			return std::move(out.bytes);
+		}
+
+		std::vector<Scalar> constants;
+		std::vector<Scalar> registers;
+		std::size_t outputCount;
+		ExecutableMemory memory;
+	};
+
+	template <typename Expr> class Compiled;
+
+	// multiVarDiff expression over IndexedVariables compiled together with its gradient - calls take the same
+	// arguments as the expression's operator() and multiVarDiff::gradient
+	template <typename Scalar, multiVarDiff::ExprType exprType, typename... Ts>
+	class Compiled<multiVarDiff::Expression<Scalar, exprType, Ts...>> {
+		using Expr = multiVarDiff::Expression<Scalar, exprType, Ts...>;
+		static constexpr std::size_t slots = multiVarDiff::indexedSlots<Expr>;
+
+	public:
+		explicit Compiled(const Expr& expr) : expr(expr) {
+			graph::Graph<Scalar> lowered = graph::toGraph(expr);
+			NativeProgram<Scalar> valueCode{bytecode::Program<Scalar>{lowered}};
+			NativeProgram<Scalar> gradientCode{bytecode::Program<Scalar>{graph::gradientGraph(lowered, lowered.outputs()[0])}};
+			if (valueCode && gradientCode) native.emplace(std::move(valueCode), std::move(gradientCode));
+		}
+
+		// true when calls run native code rather than the expression
+		bool isNative() const { return native.has_value(); }
+
+		Scalar operator()(std::span<const Scalar> values) {
+			if (!native) return expr(values);
+			Scalar value;
+			native->value(values, std::span<Scalar>{&value, 1});
+			return value;
+		}
+
+		// writes d/dIndexedVariable<i> to partials[i] and returns the value; like multiVarDiff::gradient, entries
+		// past the indexed variables are zeroed and a short partials receives only its leading partials
+		Scalar gradient(std::span<const Scalar> values, std::span<Scalar> partials) {
+			if (!native) return multiVarDiff::gradient(expr, values, partials);
+			std::array<Scalar, slots + 1> outputs;
+			native->gradient(values, outputs);
+			std::ranges::fill(partials, Scalar(0));
+			std::copy_n(outputs.begin() + 1, std::min(slots, partials.size()), partials.begin());
+			return outputs[0];
+		}
+
+	private:
+		struct Native {
+			NativeProgram<Scalar> value;
+			NativeProgram<Scalar> gradient;
+		};
+
+		Expr expr;
+		std::optional<Native> native;
+	};
+
+	// singleVarDiff expression compiled together with its derivative - calls mirror operator() and evalDual
+	template <typename Scalar, singleVarDiff::ExprType exprType, typename... Ts>
+	class Compiled<singleVarDiff::Expression<Scalar, exprType, Ts...>> {
+		using Expr = singleVarDiff::Expression<Scalar, exprType, Ts...>;
+
+	public:
+		explicit Compiled(const Expr& expr) : expr(expr) {
+			graph::Graph<Scalar> lowered = graph::toGraph(expr);
+			NativeProgram<Scalar> valueCode{bytecode::Program<Scalar>{lowered}};
+			NativeProgram<Scalar> derivativeCode{bytecode::compileGradient(expr)};
+			if (valueCode && derivativeCode) native.emplace(std::move(valueCode), std::move(derivativeCode));
+		}
+
+		bool isNative() const { return native.has_value(); }
+
+		Scalar operator()(Scalar x) {
+			if (!native) return expr(x);
+			Scalar value;
+			native->value(std::span<const Scalar>{&x, 1}, std::span<Scalar>{&value, 1});
+			return value;
+		}
+
+		singleVarDiff::Dual<Scalar> evalDual(Scalar x) {
+			if (!native) return expr.evalDual(x);
+			// a graph without the variable has no input slot and its derivative graph no second output
+			std::array<Scalar, 2> outputs{};
+			native->derivative(std::span<const Scalar>{&x, 1}, std::span<Scalar>{outputs.data(), native->derivative.outputs()});
+			return {outputs[0], outputs[1]};
+		}
+
+	private:
+		struct Native {
+			NativeProgram<Scalar> value;
+			NativeProgram<Scalar> derivative;
+		};
+
+		Expr expr;
+		std::optional<Native> native;
+	};
+
+	// compiles expr and its derivative - jit::compile(f)(values) equals f(values)
+	template <typename Expr>
+	Compiled<Expr> compile(const Expr& expr) { return Compiled<Expr>{expr}; }
+
+}
+
+#undef AUTODIFF_JIT_X86_64
@@ -0,0 +1,51 @@
+#pragma once
+#include <array>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include "Graph.h"
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+
+// lowering of singleVarDiff / multiVarDiff expression templates into a graph::Graph - models keep the operator
+// syntax of main.cpp while running on the flat, deduplicated representation
+namespace graph {
+
+	static_assert(opOf(singleVarDiff::ExprType::Quotient) == Op::Quotient && opOf(singleVarDiff::ExprType::Pow) == Op::Pow);
+	static_assert(opOf(multiVarDiff::ExprType::Quotient) == Op::Quotient && opOf(multiVarDiff::ExprType::Pow) == Op::Pow);
+
+	// adds the nodes of a singleVarDiff expression to graph and returns its root - the variable reads inputs[0]
+	template <typename Scalar, singleVarDiff::ExprType exprType, typename... Ts>
+	NodeId lower(Graph<Scalar>& graph, const singleVarDiff::Expression<Scalar, exprType, Ts...>& expr) {
+		return singleVarDiff::appendTo(graph, expr);
+	}
+
+	// adds the nodes of a multiVarDiff expression to graph and returns its root. IndexedVariable<i> reads inputs[i];
+	// variables bound by address read inputs[position in bound]. Throws std::invalid_argument for a variable
+	// that is neither
+	template <typename Scalar, multiVarDiff::ExprType exprType, typename... Ts, std::size_t count>
+	NodeId lower(Graph<Scalar>& graph, const multiVarDiff::Expression<Scalar, exprType, Ts...>& expr,
+				 const std::array<const multiVarDiff::BasicVariable<Scalar>*, count>& bound) {
+		return multiVarDiff::appendTo(graph, expr, std::span<const multiVarDiff::BasicVariable<Scalar>* const>{bound}, 0);
+	}
+
+	// graph of a single expression with its root as the only output
+	template <typename Scalar, singleVarDiff::ExprType exprType, typename... Ts>
+	Graph<Scalar> toGraph(const singleVarDiff::Expression<Scalar, exprType, Ts...>& expr) {
+		Graph<Scalar> graph;
+		graph.addOutput(lower(graph, expr));
+		return graph;
+	}
+
+	// graph of a single expression with its root as the only output - vars bound by address take the input
+	// slots in the order given, e.g. toGraph(expr, x, y)
+	template <typename Scalar, multiVarDiff::ExprType exprType, typename... Ts>
+	Graph<Scalar> toGraph(const multiVarDiff::Expression<Scalar, exprType, Ts...>& expr,
+						  const std::same_as<multiVarDiff::BasicVariable<Scalar>> auto&... vars) {
+		Graph<Scalar> graph;
+		graph.addOutput(lower(graph, expr, std::array<const multiVarDiff::BasicVariable<Scalar>*, sizeof...(vars)>{&vars...}));
+		return graph;
+	}
+
+}
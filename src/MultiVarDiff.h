@@ -1,5 +1,26 @@
 #pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+#include <vector>
+#include "CommonSubexpressions.h"
+#include "Elementary.h"
+#include "Graph.h"
+#include "Simd.h"
+
+// derivatives whose expression type would exceed this many nodes are erased into a graph - see ExprType::Erased
+#ifndef AUTODIFF_ERASURE_NODES
+#define AUTODIFF_ERASURE_NODES 128
+#endif
 
 // implements differentiation using multiple variables
 namespace multiVarDiff {
@@ -10,167 +31,1255 @@ namespace multiVarDiff {
 		Sum,
 		Difference,
 		Product,
-		Quotient
+		Quotient,
+		Exp,
+		Log,
+		Sin,
+		Cos,
+		Sqrt,
+		Pow,
+		Erased		// structure held in a graph::Graph rather than in the type
 	};
 
-	template <ExprType exprType, typename... Ts> struct Expression;
+	// elementary function nodes that share one implementation - Pow carries an exponent and is separate
+	constexpr bool isElementary(ExprType exprType) { return exprType >= ExprType::Exp && exprType <= ExprType::Sqrt; }
+
+	constexpr elementary::Function functionOf(ExprType exprType) {
+		switch (exprType) {
+		case ExprType::Exp: return elementary::Function::Exp;
+		case ExprType::Log: return elementary::Function::Log;
+		case ExprType::Sin: return elementary::Function::Sin;
+		case ExprType::Cos: return elementary::Function::Cos;
+		default: return elementary::Function::Sqrt;
+		}
+	}
+
+	// Scalar is the precision constants are stored and expressions are evaluated in
+	template <typename Scalar, ExprType exprType, typename... Ts> struct Expression;
+
+	// expr while its type has at most AUTODIFF_ERASURE_NODES nodes, otherwise the same function as an Erased node -
+	// applied to every derivative, so repeated dx() cannot grow types without bound
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto capped(const Expression<Scalar, exprType, Ts...>& expr);
+
+	// precision of an expression type
+	template <typename Expr> struct ScalarOf;
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	struct ScalarOf<Expression<Scalar, exprType, Ts...>> { using type = Scalar; };
+	template <typename Expr>
+	using ScalarOfT = typename ScalarOf<Expr>::type;
 
 	// Evaluation variable - keeps track of which variable we're differentiating wrt
+	template <typename Scalar>
 	struct EvalVariable {
-		const Expression<ExprType::Variable>* initAddress;
-		float value;
+		const Expression<Scalar, ExprType::Variable>* initAddress;
+		Scalar value;
 	};
 
+	// value and partial derivative of an expression at a point, propagated together by evalDual.
+	// The arithmetic lets the forward/adjoint passes run on dual numbers for Hessian-vector products
+	template <typename Scalar>
+	struct Dual {
+		constexpr Dual() = default;
+		constexpr Dual(Scalar value, Scalar derivative = 0) : value(value), derivative(derivative) {}
+
+		friend constexpr Dual operator-(const Dual& u) { return {-u.value, -u.derivative}; }
+		friend constexpr Dual operator+(const Dual& lhs, const Dual& rhs) { return {lhs.value + rhs.value, lhs.derivative + rhs.derivative}; }
+		friend constexpr Dual operator-(const Dual& lhs, const Dual& rhs) { return {lhs.value - rhs.value, lhs.derivative - rhs.derivative}; }
+		friend constexpr Dual operator*(const Dual& lhs, const Dual& rhs) {
+			return {lhs.value * rhs.value, lhs.derivative * rhs.value + lhs.value * rhs.derivative};
+		}
+		friend constexpr Dual operator/(const Dual& lhs, const Dual& rhs) {
+			Scalar value = lhs.value / rhs.value;
+			return {value, (lhs.derivative - value * rhs.derivative) / rhs.value};
+		}
+
+		Scalar value;
+		Scalar derivative;
+	};
+
+	// elementary functions of dual numbers - one kernel call gives the value and the slope that scales the derivative
+	template <elementary::Function function, typename Scalar>
+	constexpr Dual<Scalar> dualOf(const Dual<Scalar>& u) {
+		elementary::ValueSlope<Scalar> f = elementary::valueSlope<function>(u.value);
+		return {f.value, f.slope * u.derivative};
+	}
+
+	template <typename Scalar> constexpr Dual<Scalar> exp(const Dual<Scalar>& u) { return dualOf<elementary::Function::Exp>(u); }
+	template <typename Scalar> constexpr Dual<Scalar> log(const Dual<Scalar>& u) { return dualOf<elementary::Function::Log>(u); }
+	template <typename Scalar> constexpr Dual<Scalar> sin(const Dual<Scalar>& u) { return dualOf<elementary::Function::Sin>(u); }
+	template <typename Scalar> constexpr Dual<Scalar> cos(const Dual<Scalar>& u) { return dualOf<elementary::Function::Cos>(u); }
+	template <typename Scalar> constexpr Dual<Scalar> sqrt(const Dual<Scalar>& u) { return dualOf<elementary::Function::Sqrt>(u); }
+	template <typename Scalar>
+	constexpr Dual<Scalar> pow(const Dual<Scalar>& u, std::type_identity_t<Scalar> exponent) {
+		elementary::ValueSlope<Scalar> f = elementary::powValueSlope(u.value, exponent);
+		return {f.value, f.slope * u.derivative};
+	}
+
+	// value and count directional derivatives, propagated together in vector forward mode.
+	// The derivatives are contiguous and aligned, so each operation is a few whole-register vector instructions
+	template <typename Scalar, std::size_t count>
+	struct VectorDual {
+		constexpr VectorDual() = default;
+		constexpr VectorDual(Scalar value) : value(value) {}
+
+		friend constexpr VectorDual operator-(const VectorDual& u) {
+			VectorDual w{-u.value};
+			for (std::size_t d = 0; d < count; ++d) w.derivatives[d] = -u.derivatives[d];
+			return w;
+		}
+		friend constexpr VectorDual operator+(const VectorDual& lhs, const VectorDual& rhs) {
+			VectorDual w{lhs.value + rhs.value};
+			for (std::size_t d = 0; d < count; ++d) w.derivatives[d] = lhs.derivatives[d] + rhs.derivatives[d];
+			return w;
+		}
+		friend constexpr VectorDual operator-(const VectorDual& lhs, const VectorDual& rhs) {
+			VectorDual w{lhs.value - rhs.value};
+			for (std::size_t d = 0; d < count; ++d) w.derivatives[d] = lhs.derivatives[d] - rhs.derivatives[d];
+			return w;
+		}
+		friend constexpr VectorDual operator*(const VectorDual& lhs, const VectorDual& rhs) {
+			VectorDual w{lhs.value * rhs.value};
+			for (std::size_t d = 0; d < count; ++d) w.derivatives[d] = lhs.derivatives[d] * rhs.value + lhs.value * rhs.derivatives[d];
+			return w;
+		}
+		friend constexpr VectorDual operator/(const VectorDual& lhs, const VectorDual& rhs) {
+			VectorDual w{lhs.value / rhs.value};
+			Scalar reciprocal = Scalar(1) / rhs.value;
+			for (std::size_t d = 0; d < count; ++d) w.derivatives[d] = (lhs.derivatives[d] - w.value * rhs.derivatives[d]) * reciprocal;
+			return w;
+		}
+
+		// every derivative scaled by slope - the chain rule through a function of one argument
+		constexpr VectorDual chain(Scalar result, Scalar slope) const {
+			VectorDual w{result};
+			for (std::size_t d = 0; d < count; ++d) w.derivatives[d] = slope * derivatives[d];
+			return w;
+		}
+
+		alignas(std::min<std::size_t>(64, std::bit_floor(sizeof(Scalar) * count))) std::array<Scalar, count> derivatives{};
+		Scalar value;
+	};
+
+	template <elementary::Function function, typename Scalar, std::size_t count>
+	constexpr VectorDual<Scalar, count> dualOf(const VectorDual<Scalar, count>& u) {
+		elementary::ValueSlope<Scalar> f = elementary::valueSlope<function>(u.value);
+		return u.chain(f.value, f.slope);
+	}
+
+	template <typename Scalar, std::size_t count> constexpr VectorDual<Scalar, count> exp(const VectorDual<Scalar, count>& u) { return dualOf<elementary::Function::Exp>(u); }
+	template <typename Scalar, std::size_t count> constexpr VectorDual<Scalar, count> log(const VectorDual<Scalar, count>& u) { return dualOf<elementary::Function::Log>(u); }
+	template <typename Scalar, std::size_t count> constexpr VectorDual<Scalar, count> sin(const VectorDual<Scalar, count>& u) { return dualOf<elementary::Function::Sin>(u); }
+	template <typename Scalar, std::size_t count> constexpr VectorDual<Scalar, count> cos(const VectorDual<Scalar, count>& u) { return dualOf<elementary::Function::Cos>(u); }
+	template <typename Scalar, std::size_t count> constexpr VectorDual<Scalar, count> sqrt(const VectorDual<Scalar, count>& u) { return dualOf<elementary::Function::Sqrt>(u); }
+	template <typename Scalar, std::size_t count>
+	constexpr VectorDual<Scalar, count> pow(const VectorDual<Scalar, count>& u, std::type_identity_t<Scalar> exponent) {
+		elementary::ValueSlope<Scalar> f = elementary::powValueSlope(u.value, exponent);
+		return u.chain(f.value, f.slope);
+	}
+
+	// Forward pass record - value of a node plus the records of its operands, read back by the adjoint pass
+	template <typename Scalar, typename... Operands> struct Primal;
+
+	template <typename Scalar>
+	struct Primal<Scalar> {
+		Scalar value;
+	};
+
+	// unary nodes keep the slope of their function, computed alongside the value
+	template <typename Scalar, typename Operand>
+	struct Primal<Scalar, Operand> {
+		Scalar value;
+		Scalar slope;
+		Operand operand;
+	};
+
+	template <typename Scalar, typename LHS, typename RHS>
+	struct Primal<Scalar, LHS, RHS> {
+		Scalar value;
+		LHS lhs;
+		RHS rhs;
+	};
+
+	struct Zero {};
+	struct One {};
+
+	// Constants known at compile time to be zero or one - operators fold them away, so derivatives
+	// with respect to an IndexedVariable drop the terms that vanish
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Constant, Zero> {
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return 0; }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return 0; }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return 0.0f; }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return Scalar(0); }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const { return Expression<Scalar, ExprType::Constant, Zero>{}; }
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const { return {0, 0}; }
+		constexpr Primal<Scalar> forward(const auto&... args) const { return {0}; }
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {}
+		static constexpr Scalar value = 0;
+	};
+	template <typename Scalar>
+	using BasicZeroExpr = Expression<Scalar, ExprType::Constant, Zero>;
+	using ZeroExpr = BasicZeroExpr<float>;
+
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Constant, One> {
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return 1; }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return 1; }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return 1.0f; }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return Scalar(1); }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const { return Expression<Scalar, ExprType::Constant, Zero>{}; }
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const { return {1, 0}; }
+		constexpr Primal<Scalar> forward(const auto&... args) const { return {1}; }
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {}
+		static constexpr Scalar value = 1;
+	};
+	template <typename Scalar>
+	using BasicOneExpr = Expression<Scalar, ExprType::Constant, One>;
+	using OneExpr = BasicOneExpr<float>;
+
 	// Constant
-	template <>
-	struct Expression<ExprType::Constant> {
-		template <typename T> constexpr Expression<ExprType::Constant>(T x) : value(static_cast<float>(x)) {}
-		constexpr Expression<ExprType::Constant>() = default;
-		constexpr float operator()(EvalVariable args...) const { return value; }
-		constexpr auto dx(const Expression<ExprType::Variable>& args...) const { return Expression<ExprType::Constant>{}; }
-		float value;
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Constant> {
+		template <typename T> constexpr Expression(T x) : value(static_cast<Scalar>(x)) {}
+		constexpr Expression() = default;
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return value; }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return value; }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return value; }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return value; }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const { return Expression<Scalar, ExprType::Constant, Zero>{}; }
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const { return {value, 0}; }
+		constexpr Primal<Scalar> forward(const auto&... args) const { return {value}; }
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {}
+		Scalar value;
 	};
 
-	using Constant = Expression<ExprType::Constant>;
+	template <typename Scalar>
+	using BasicConstant = Expression<Scalar, ExprType::Constant>;
+	using Constant = BasicConstant<float>;
 
-	// Variable
-	template <>
-	struct Expression<ExprType::Variable> {
-		constexpr float operator()(const EvalVariable& x, std::convertible_to<const EvalVariable&> auto... args) const {
+	// Variable - identified by its address, so it is usable in constant expressions when it has static storage or
+	// is created within the same constant evaluation
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Variable> {
+		constexpr Scalar operator()(const EvalVariable<Scalar>& x, std::convertible_to<const EvalVariable<Scalar>&> auto... args) const {
 			return x.initAddress == initAddress ? x.value : operator()(args...);
 		}
 		
-		constexpr float operator()(const EvalVariable& x) const { return x.initAddress == initAddress ? x.value : 0; }
+		constexpr Scalar operator()(const EvalVariable<Scalar>& x) const { return x.initAddress == initAddress ? x.value : 0; }
 		
-		constexpr auto dx(const Expression<ExprType::Variable>& var) const { return Expression<ExprType::Constant>{ var.initAddress == initAddress ? 1 : 0 }; }
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable>& var) const { return Expression<Scalar, ExprType::Constant>{ var.initAddress == initAddress ? 1 : 0 }; }
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable>& var, const auto&... args) const {
+			return {operator()(args...), Scalar(var.initAddress == initAddress ? 1 : 0)};
+		}
+		constexpr Primal<Scalar> forward(const auto&... args) const { return {operator()(args...)}; }
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const { adjoints.add(*this, adjoint); }
+
+		constexpr EvalVariable<Scalar> operator=(Scalar value) const { return EvalVariable<Scalar>{initAddress, value}; }
+		Expression<Scalar, ExprType::Variable>* initAddress = this;
+	};
+
+	template <typename Scalar>
+	using BasicVariable = Expression<Scalar, ExprType::Variable>;
+	using Variable = BasicVariable<float>;
+
+	// Compile-time variable slot - the variable's value is read from values[index]
+	template <std::size_t index> struct Index {};
+
+	// Indexed variable - bound by position in a flat array of values instead of by address,
+	// so evaluating a leaf is a single load rather than a search over the bound variables
+	template <typename Scalar, std::size_t index>
+	struct Expression<Scalar, ExprType::Variable, Index<index>> {
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return values[index]; }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return values[index]; }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return values[index]; }
 
-		constexpr EvalVariable operator=(float value) const { return EvalVariable{initAddress, value}; }
-		Expression<ExprType::Variable>* initAddress = this;
+		template <std::size_t other>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Index<other>>& var) const {
+			if constexpr (index == other) return Expression<Scalar, ExprType::Constant, One>{};
+			else return Expression<Scalar, ExprType::Constant, Zero>{};
+		}
+		template <std::size_t other>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Index<other>>& var, std::span<const Scalar> values) const {
+			return {values[index], Scalar(index == other ? 1 : 0)};
+		}
+		constexpr Primal<Scalar> forward(std::span<const Scalar> values) const { return {values[index]}; }
+		constexpr Primal<Dual<Scalar>> forward(std::span<const Dual<Scalar>> values) const { return {values[index]}; }
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const { adjoints.add(*this, adjoint); }
 	};
 
-	using Variable = Expression<ExprType::Variable>;
+	template <typename Scalar, std::size_t index>
+	using BasicIndexedVariable = Expression<Scalar, ExprType::Variable, Index<index>>;
+	template <std::size_t index>
+	using IndexedVariable = BasicIndexedVariable<float, index>;
+
+	// number of value slots an expression reads - one past the highest IndexedVariable index it contains
+	template <typename T> constexpr std::size_t indexedSlots = 0;
+	template <typename Scalar, std::size_t index>
+	constexpr std::size_t indexedSlots<BasicIndexedVariable<Scalar, index>> = index + 1;
+	template <typename Scalar, ExprType exprType, typename LHS, typename RHS>
+	constexpr std::size_t indexedSlots<Expression<Scalar, exprType, LHS, RHS>> = std::max(indexedSlots<LHS>, indexedSlots<RHS>);
+	template <typename Scalar, ExprType exprType, ExprType exprType1, typename... Ts1>
+	constexpr std::size_t indexedSlots<Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>>> = indexedSlots<Expression<Scalar, exprType1, Ts1...>>;
+
+	// Compile-time dependency set of an expression type. dependsOn<T, Index<i>> tells whether T reads
+	// IndexedVariable<i>; dependsOn<T> whether it contains any variable bound by address, whose identity is only
+	// known at run time. Derivatives with respect to a variable outside the set are the Zero type, and the subtree
+	// is never differentiated
+	template <typename T, typename... Vs> constexpr bool dependsOn = false;
+	template <typename Scalar, typename... Vs>
+	constexpr bool dependsOn<Expression<Scalar, ExprType::Variable, Vs...>, Vs...> = true;
+	template <typename Scalar, ExprType exprType, typename LHS, typename RHS, typename... Vs>
+	constexpr bool dependsOn<Expression<Scalar, exprType, LHS, RHS>, Vs...> = dependsOn<LHS, Vs...> || dependsOn<RHS, Vs...>;
+	template <typename Scalar, ExprType exprType, ExprType exprType1, typename... Ts1, typename... Vs>
+	constexpr bool dependsOn<Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>>, Vs...> = dependsOn<Expression<Scalar, exprType1, Ts1...>, Vs...>;
 
 	// Sum
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	struct Expression<ExprType::Sum, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>> {
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	struct Expression<Scalar, ExprType::Sum, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>> {
 
-		constexpr float operator()(std::convertible_to<const EvalVariable&> auto... args) const { return lhs(args...) + rhs(args...); }
-		constexpr auto dx(const Expression<ExprType::Variable>& var) const { return lhs.dx(var) + rhs.dx(var); }
+		static constexpr auto apply(const auto& l, const auto& r) { return l + r; }
 
-		Expression<exprType1, Ts1...> lhs;
-		Expression<exprType2, Ts2...> rhs;
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return lhs(args...) + rhs(args...); }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return lhs(values) + rhs(values); }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return lhs(values) + rhs(values); }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return lhs(values) + rhs(values); }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return BasicZeroExpr<Scalar>{};
+			else return capped(lhs.dx(var) + rhs.dx(var));
+		}
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return {operator()(args...), 0};
+			Dual<Scalar> l = lhs.evalDual(var, args...);
+			Dual<Scalar> r = rhs.evalDual(var, args...);
+			return {l.value + r.value, l.derivative + r.derivative};
+		}
+		constexpr auto forward(const auto&... args) const {
+			auto l = lhs.forward(args...);
+			auto r = rhs.forward(args...);
+			auto value = l.value + r.value;
+			return Primal<decltype(value), decltype(l), decltype(r)>{value, std::move(l), std::move(r)};
+		}
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {
+			lhs.backward(primal.lhs, adjoint, adjoints);
+			rhs.backward(primal.rhs, adjoint, adjoints);
+		}
+
+		Expression<Scalar, exprType1, Ts1...> lhs;
+		Expression<Scalar, exprType2, Ts2...> rhs;
 	};
 
 	// sum of expressions
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	constexpr auto operator+(const Expression<exprType1, Ts1...>& lhs,
-							 const Expression<exprType2, Ts2...>& rhs) {
-		using TypeLHS = Expression<exprType1, Ts1...>;
-		using TypeRHS = Expression<exprType2, Ts2...>;
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	constexpr auto operator+(const Expression<Scalar, exprType1, Ts1...>& lhs,
+							 const Expression<Scalar, exprType2, Ts2...>& rhs) {
+		using TypeLHS = Expression<Scalar, exprType1, Ts1...>;
+		using TypeRHS = Expression<Scalar, exprType2, Ts2...>;
 
-		if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
-			return Constant{lhs.value + rhs.value};
+		if constexpr (std::is_same_v<TypeLHS, BasicZeroExpr<Scalar>>) return rhs;
+		else if constexpr (std::is_same_v<TypeRHS, BasicZeroExpr<Scalar>>) return lhs;
+		else if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
+			return BasicConstant<Scalar>{lhs.value + rhs.value};
 		}
 		else {
-			return Expression<ExprType::Sum, TypeLHS, TypeRHS>{lhs, rhs};
+			return Expression<Scalar, ExprType::Sum, TypeLHS, TypeRHS>{lhs, rhs};
 		}
 	}
 
 	// Difference
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	struct Expression<ExprType::Difference, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>> {
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	struct Expression<Scalar, ExprType::Difference, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>> {
 
-		constexpr float operator()(std::convertible_to<const EvalVariable&> auto... args) const { return lhs(args...) - rhs(args...); }
-		constexpr auto dx(const Expression<ExprType::Variable>& var) const { return lhs.dx(var) - rhs.dx(var); }
+		static constexpr auto apply(const auto& l, const auto& r) { return l - r; }
+
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return lhs(args...) - rhs(args...); }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return lhs(values) - rhs(values); }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return lhs(values) - rhs(values); }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return lhs(values) - rhs(values); }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return BasicZeroExpr<Scalar>{};
+			else return capped(lhs.dx(var) - rhs.dx(var));
+		}
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return {operator()(args...), 0};
+			Dual<Scalar> l = lhs.evalDual(var, args...);
+			Dual<Scalar> r = rhs.evalDual(var, args...);
+			return {l.value - r.value, l.derivative - r.derivative};
+		}
+		constexpr auto forward(const auto&... args) const {
+			auto l = lhs.forward(args...);
+			auto r = rhs.forward(args...);
+			auto value = l.value - r.value;
+			return Primal<decltype(value), decltype(l), decltype(r)>{value, std::move(l), std::move(r)};
+		}
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {
+			lhs.backward(primal.lhs, adjoint, adjoints);
+			rhs.backward(primal.rhs, -adjoint, adjoints);
+		}
 
-		Expression<exprType1, Ts1...> lhs;
-		Expression<exprType2, Ts2...> rhs;
+		Expression<Scalar, exprType1, Ts1...> lhs;
+		Expression<Scalar, exprType2, Ts2...> rhs;
 	};
 
 	// difference of expressions
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	auto operator-(const Expression<exprType1, Ts1...>& lhs,
-				   const Expression<exprType2, Ts2...>& rhs) {
-		using TypeLHS = Expression<exprType1, Ts1...>;
-		using TypeRHS = Expression<exprType2, Ts2...>;
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	constexpr auto operator-(const Expression<Scalar, exprType1, Ts1...>& lhs,
+				   const Expression<Scalar, exprType2, Ts2...>& rhs) {
+		using TypeLHS = Expression<Scalar, exprType1, Ts1...>;
+		using TypeRHS = Expression<Scalar, exprType2, Ts2...>;
 
-		if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
-			return Expression<ExprType::Constant>{lhs.value - rhs.value};
+		if constexpr (std::is_same_v<TypeRHS, BasicZeroExpr<Scalar>>) return lhs;
+		else if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
+			return Expression<Scalar, ExprType::Constant>{lhs.value - rhs.value};
 		}
 		else {
-			return Expression<ExprType::Difference, TypeLHS, TypeRHS>{lhs, rhs};
+			return Expression<Scalar, ExprType::Difference, TypeLHS, TypeRHS>{lhs, rhs};
 		}
 	}
 
 	// Product
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	struct Expression<ExprType::Product, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>> {
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	struct Expression<Scalar, ExprType::Product, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>> {
 
-		constexpr float operator()(std::convertible_to<const EvalVariable&> auto... args) const { return lhs(args...) * rhs(args...); }
-		constexpr auto dx(const Expression<ExprType::Variable>& var) const { return lhs.dx(var) * rhs + lhs * rhs.dx(var); }
+		static constexpr auto apply(const auto& l, const auto& r) { return l * r; }
 
-		Expression<exprType1, Ts1...> lhs;
-		Expression<exprType2, Ts2...> rhs;
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return lhs(args...) * rhs(args...); }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return lhs(values) * rhs(values); }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return lhs(values) * rhs(values); }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return lhs(values) * rhs(values); }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return BasicZeroExpr<Scalar>{};
+			else return capped(lhs.dx(var) * rhs + lhs * rhs.dx(var));
+		}
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return {operator()(args...), 0};
+			Dual<Scalar> l = lhs.evalDual(var, args...);
+			Dual<Scalar> r = rhs.evalDual(var, args...);
+			return {l.value * r.value, l.derivative * r.value + l.value * r.derivative};
+		}
+		constexpr auto forward(const auto&... args) const {
+			auto l = lhs.forward(args...);
+			auto r = rhs.forward(args...);
+			auto value = l.value * r.value;
+			return Primal<decltype(value), decltype(l), decltype(r)>{value, std::move(l), std::move(r)};
+		}
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {
+			lhs.backward(primal.lhs, adjoint * primal.rhs.value, adjoints);
+			rhs.backward(primal.rhs, adjoint * primal.lhs.value, adjoints);
+		}
+
+		Expression<Scalar, exprType1, Ts1...> lhs;
+		Expression<Scalar, exprType2, Ts2...> rhs;
 	};
 
 	// product of expressions
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	auto operator*(const Expression<exprType1, Ts1...>& lhs,
-				   const Expression<exprType2, Ts2...>& rhs) {
-		using TypeLHS = Expression<exprType1, Ts1...>;
-		using TypeRHS = Expression<exprType2, Ts2...>;
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	constexpr auto operator*(const Expression<Scalar, exprType1, Ts1...>& lhs,
+				   const Expression<Scalar, exprType2, Ts2...>& rhs) {
+		using TypeLHS = Expression<Scalar, exprType1, Ts1...>;
+		using TypeRHS = Expression<Scalar, exprType2, Ts2...>;
 
-		if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
-			return Expression<ExprType::Constant>{lhs.value * rhs.value};
+		if constexpr (std::is_same_v<TypeLHS, BasicZeroExpr<Scalar>> || std::is_same_v<TypeRHS, BasicZeroExpr<Scalar>>) return BasicZeroExpr<Scalar>{};
+		else if constexpr (std::is_same_v<TypeLHS, BasicOneExpr<Scalar>>) return rhs;
+		else if constexpr (std::is_same_v<TypeRHS, BasicOneExpr<Scalar>>) return lhs;
+		else if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
+			return Expression<Scalar, ExprType::Constant>{lhs.value * rhs.value};
 		}
 		else {
-			return Expression<ExprType::Product, TypeLHS, TypeRHS>{lhs, rhs};
+			return Expression<Scalar, ExprType::Product, TypeLHS, TypeRHS>{lhs, rhs};
 		}
 	}
 
 	// Quotient
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	struct Expression<ExprType::Quotient, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>> {
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	struct Expression<Scalar, ExprType::Quotient, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>> {
+
+		static constexpr auto apply(const auto& l, const auto& r) { return l / r; }
 
-		constexpr float operator()(std::convertible_to<const EvalVariable&> auto... args) const { return lhs(args...) / rhs(args...); }
-		constexpr auto dx(const Expression<ExprType::Variable>& var) const { return (lhs.dx(var) * rhs - lhs * rhs.dx(var)) / (rhs * rhs); }
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return lhs(args...) / rhs(args...); }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return lhs(values) / rhs(values); }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return lhs(values) / rhs(values); }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return lhs(values) / rhs(values); }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return BasicZeroExpr<Scalar>{};
+			else return capped((lhs.dx(var) * rhs - lhs * rhs.dx(var)) / (rhs * rhs));
+		}
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return {operator()(args...), 0};
+			Dual<Scalar> l = lhs.evalDual(var, args...);
+			Dual<Scalar> r = rhs.evalDual(var, args...);
+			Scalar value = l.value / r.value;
+			return {value, (l.derivative - value * r.derivative) / r.value};
+		}
+		constexpr auto forward(const auto&... args) const {
+			auto l = lhs.forward(args...);
+			auto r = rhs.forward(args...);
+			auto value = l.value / r.value;
+			return Primal<decltype(value), decltype(l), decltype(r)>{value, std::move(l), std::move(r)};
+		}
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {
+			lhs.backward(primal.lhs, adjoint / primal.rhs.value, adjoints);
+			rhs.backward(primal.rhs, -adjoint * primal.value / primal.rhs.value, adjoints);
+		}
 
-		Expression<exprType1, Ts1...> lhs;
-		Expression<exprType2, Ts2...> rhs;
+		Expression<Scalar, exprType1, Ts1...> lhs;
+		Expression<Scalar, exprType2, Ts2...> rhs;
 	};
 
 	// quotient of expressions
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	auto operator/(const Expression<exprType1, Ts1...>& lhs,
-				   const Expression<exprType2, Ts2...>& rhs) {
-		using TypeLHS = Expression<exprType1, Ts1...>;
-		using TypeRHS = Expression<exprType2, Ts2...>;
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	constexpr auto operator/(const Expression<Scalar, exprType1, Ts1...>& lhs,
+				   const Expression<Scalar, exprType2, Ts2...>& rhs) {
+		using TypeLHS = Expression<Scalar, exprType1, Ts1...>;
+		using TypeRHS = Expression<Scalar, exprType2, Ts2...>;
 
-		if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
-			return Expression<ExprType::Constant>{lhs.value / rhs.value};
+		if constexpr (std::is_same_v<TypeLHS, BasicZeroExpr<Scalar>>) return BasicZeroExpr<Scalar>{};
+		else if constexpr (std::is_same_v<TypeRHS, BasicOneExpr<Scalar>>) return lhs;
+		else if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
+			return Expression<Scalar, ExprType::Constant>{lhs.value / rhs.value};
 		}
 		else {
-			return Expression<ExprType::Quotient, TypeLHS, TypeRHS>{lhs, rhs};
+			return Expression<Scalar, ExprType::Quotient, TypeLHS, TypeRHS>{lhs, rhs};
 		}
 	}
 
-	// global operators with floats
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator+(const Expression<exprType, Ts...>& lhs, float rhs) { return Expression<ExprType::Sum, Expression<exprType, Ts...>, Constant>{lhs, rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator+(float lhs, const Expression<exprType, Ts...>& rhs) { return Expression<ExprType::Sum, Constant, Expression<exprType, Ts...>>{lhs, rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator-(const Expression<exprType, Ts...>& lhs, float rhs) { return Expression<ExprType::Difference, Expression<exprType, Ts...>, Constant>{lhs, rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator-(float lhs, const Expression<exprType, Ts...>& rhs) { return Expression<ExprType::Difference, Constant, Expression<exprType, Ts...>>{lhs, rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator*(const Expression<exprType, Ts...>& lhs, float rhs) { return Expression<ExprType::Product, Expression<exprType, Ts...>, Constant>{lhs, rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator*(float lhs, const Expression<exprType, Ts...>& rhs) { return Expression<ExprType::Product, Constant, Expression<exprType, Ts...>>{lhs, rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator/(const Expression<exprType, Ts...>& lhs, float rhs) { return Expression<ExprType::Quotient, Expression<exprType, Ts...>, Constant>{lhs, rhs}; }
+	// Elementary function of an expression - exp, log, sin, cos, sqrt
+	template <typename Scalar, ExprType exprType, ExprType exprType1, typename... Ts1>
+		requires (isElementary(exprType))
+	struct Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>> {
+		static constexpr elementary::Function function = functionOf(exprType);
+
+		static constexpr auto apply(const auto& u) { return elementary::value<function>(u); }
+
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return apply(operand(args...)); }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return apply(operand(values)); }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return apply(operand(values)); }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return apply(operand(values)); }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return BasicZeroExpr<Scalar>{};
+			else return capped(slope() * operand.dx(var));
+		}
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return {operator()(args...), 0};
+			Dual<Scalar> u = operand.evalDual(var, args...);
+			elementary::ValueSlope<Scalar> f = elementary::valueSlope<function>(u.value);
+			return {f.value, f.slope * u.derivative};
+		}
+		constexpr auto forward(const auto&... args) const {
+			auto u = operand.forward(args...);
+			auto f = elementary::valueSlope<function>(u.value);
+			return Primal<decltype(f.value), decltype(u)>{f.value, f.slope, std::move(u)};
+		}
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {
+			operand.backward(primal.operand, adjoint * primal.slope, adjoints);
+		}
+
+		// derivative with respect to the operand, as an expression
+		constexpr auto slope() const {
+			if constexpr (exprType == ExprType::Exp) return *this;
+			else if constexpr (exprType == ExprType::Log) return BasicOneExpr<Scalar>{} / operand;
+			else if constexpr (exprType == ExprType::Sin) return cos(operand);
+			else if constexpr (exprType == ExprType::Cos) return Scalar(-1) * sin(operand);
+			else return Scalar(0.5) / *this;
+		}
+
+		Expression<Scalar, exprType1, Ts1...> operand;
+	};
+
+	// Power with a constant exponent
+	template <typename Scalar, ExprType exprType1, typename... Ts1>
+	struct Expression<Scalar, ExprType::Pow, Expression<Scalar, exprType1, Ts1...>> {
+
+		constexpr auto apply(const auto& u) const { return elementary::pow(u, exponent); }
+
+		constexpr Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return apply(operand(args...)); }
+		constexpr Scalar operator()(std::span<const Scalar> values) const { return apply(operand(values)); }
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const { return apply(operand(values)); }
+		template <std::size_t count>
+		constexpr VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const { return pow(operand(values), exponent); }
+		template <typename... Vs>
+		constexpr auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return BasicZeroExpr<Scalar>{};
+			else return capped(slope() * operand.dx(var));
+		}
+		template <typename... Vs>
+		constexpr Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const {
+			if constexpr (!dependsOn<Expression, Vs...>) return {operator()(args...), 0};
+			Dual<Scalar> u = operand.evalDual(var, args...);
+			elementary::ValueSlope<Scalar> f = elementary::powValueSlope(u.value, exponent);
+			return {f.value, f.slope * u.derivative};
+		}
+		constexpr auto forward(const auto&... args) const {
+			auto u = operand.forward(args...);
+			auto f = elementary::powValueSlope(u.value, exponent);
+			return Primal<decltype(f.value), decltype(u)>{f.value, f.slope, std::move(u)};
+		}
+		constexpr void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {
+			operand.backward(primal.operand, adjoint * primal.slope, adjoints);
+		}
+
+		// derivative with respect to the operand, as an expression
+		constexpr auto slope() const { return exponent * pow(operand, exponent - 1); }
+
+		Expression<Scalar, exprType1, Ts1...> operand;
+		Scalar exponent;
+	};
+
+	// forward pass record of an erased node - the value of every node of its graph. The buffer is borrowed from a
+	// per-thread pool and handed back with the record, so repeated passes allocate nothing
+	template <typename T>
+	struct ErasedPrimal {
+		explicit ErasedPrimal(std::size_t size) {
+			std::vector<std::vector<T>>& free = pool();
+			if (!free.empty()) {
+				values = std::move(free.back());
+				free.pop_back();
+			}
+			values.resize(size);
+		}
+		ErasedPrimal(ErasedPrimal&& other) noexcept : value(other.value), values(std::move(other.values)) {}
+		ErasedPrimal& operator=(ErasedPrimal&&) = delete;
+		~ErasedPrimal() {
+			if (values.capacity() > 0) pool().push_back(std::move(values));
+		}
+
+		T value{};
+		std::vector<T> values;
+
+	private:
+		static std::vector<std::vector<T>>& pool() {
+			thread_local std::vector<std::vector<T>> buffers;
+			return buffers;
+		}
+	};
+
+	// Expression whose structure lives in a shared, hash-consed graph instead of its type - every distinct
+	// subexpression is one node, so the repeated subtrees of high-order derivatives cost nothing to compile and
+	// are evaluated once. Graph slots [0, slots) are IndexedVariables, slot slots + k is the variable bound[k].
+	// Calls walk the graph, with node values in a per-thread buffer
+	template <typename Scalar, std::size_t slots>
+	struct Expression<Scalar, ExprType::Erased, Index<slots>> {
+		Scalar operator()(std::convertible_to<const EvalVariable<Scalar>&> auto... args) const { return evaluate(args...); }
+		Scalar operator()(std::span<const Scalar> values) const { return evaluate(values); }
+		// all lanes at once - bound variables read zero
+		simd::FloatPack operator()(std::span<const simd::FloatPack> values) const {
+			std::span<simd::FloatPack> nodeValues = scratch<simd::FloatPack>(root + 1);
+			walk(nodeValues, indexedInputs(values));
+			return nodeValues[root];
+		}
+		// vector forward mode - every graph node carries all directions; bound variables read zero
+		template <std::size_t count>
+		VectorDual<Scalar, count> operator()(std::span<const VectorDual<Scalar, count>> values) const {
+			std::span<VectorDual<Scalar, count>> nodeValues = scratch<VectorDual<Scalar, count>>(root + 1);
+			walk(nodeValues, indexedInputs(values));
+			return nodeValues[root];
+		}
+		template <typename... Vs>
+		auto dx(const Expression<Scalar, ExprType::Variable, Vs...>& var) const {
+			std::size_t slot = slotOf(var);
+			if (slot == inputCount()) {
+				graph::Graph<Scalar> zero;
+				return erasedOf(zero, zero.constant(0), bound);
+			}
+			graph::Graph<Scalar> derivative = graph::gradientGraph(*graph, root);
+			return erasedOf(derivative, derivative.outputs()[1 + slot], bound);
+		}
+		template <typename... Vs>
+		Dual<Scalar> evalDual(const Expression<Scalar, ExprType::Variable, Vs...>& var, const auto&... args) const {
+			std::span<Scalar> buffer = scratch(2 * inputCount() + 2 * graph->size());
+			std::span<Scalar> inputs = buffer.first(inputCount());
+			std::span<Scalar> direction = buffer.subspan(inputCount(), inputCount());
+			std::span<Scalar> values = buffer.subspan(2 * inputCount(), graph->size());
+			std::span<Scalar> tangents = buffer.last(graph->size());
+			bind(inputs, args...);
+			std::ranges::fill(direction, Scalar(0));
+			if (std::size_t slot = slotOf(var); slot < inputCount()) direction[slot] = 1;
+			graph->derivative(inputs, direction, values, tangents);
+			return {values[root], tangents[root]};
+		}
+		ErasedPrimal<Scalar> forward(const auto&... args) const {
+			std::span<Scalar> inputs = scratch(inputCount());
+			bind(inputs, args...);
+			ErasedPrimal<Scalar> primal{graph->size()};
+			graph->evaluate(inputs, primal.values);
+			primal.value = primal.values[root];
+			return primal;
+		}
+		// forward pass on dual numbers, for Hessian-vector products - bound variables read zero
+		ErasedPrimal<Dual<Scalar>> forward(std::span<const Dual<Scalar>> values) const {
+			ErasedPrimal<Dual<Scalar>> primal{root + std::size_t(1)};
+			walk(std::span<Dual<Scalar>>{primal.values}, indexedInputs(values));
+			primal.value = primal.values[root];
+			return primal;
+		}
+		void backward(const auto& primal, const auto& adjoint, auto& adjoints) const {
+			using T = std::remove_cvref_t<decltype(primal.value)>;
+			std::span<T> buffer = scratch<T>(root + 1 + inputCount());
+			std::span<T> nodeAdjoints = buffer.first(root + 1);
+			std::span<T> partials = buffer.last(inputCount());
+			if constexpr (std::is_same_v<T, Scalar>) graph->gradient(root, primal.values, nodeAdjoints, partials);
+			else sweep(std::span<const T>{primal.values}, nodeAdjoints, partials);
+
+			// each accumulator takes either indexed or bound variables
+			[&]<std::size_t... index>(std::index_sequence<index...>) {
+				([&] {
+					if constexpr (requires { adjoints.add(BasicIndexedVariable<Scalar, index>{}, adjoint); }) {
+						adjoints.add(BasicIndexedVariable<Scalar, index>{}, adjoint * partials[index]);
+					}
+				}(), ...);
+			}(std::make_index_sequence<slots>{});
+			if constexpr (requires { adjoints.add(std::declval<const BasicVariable<Scalar>&>(), adjoint); }) {
+				for (std::size_t k = 0; k < bound.size(); ++k) adjoints.add(bound[k], adjoint * partials[slots + k]);
+			}
+		}
+
+		// the nodes root depends on, copied out of source into a graph of their own with one slot per variable
+		static Expression erasedOf(const graph::Graph<Scalar>& source, graph::NodeId root, std::vector<BasicVariable<Scalar>> bound) {
+			auto compact = std::make_shared<graph::Graph<Scalar>>();
+			std::vector<graph::NodeId> inputNodes(slots + bound.size());
+			for (std::size_t slot = 0; slot < inputNodes.size(); ++slot) inputNodes[slot] = compact->variable(static_cast<std::uint32_t>(slot));
+			graph::NodeId copy = compact->append(source, root, inputNodes);
+			return {compact, copy, std::move(bound)};
+		}
+
+		std::size_t inputCount() const { return slots + bound.size(); }
+
+		std::shared_ptr<const graph::Graph<Scalar>> graph;
+		graph::NodeId root;
+		std::vector<BasicVariable<Scalar>> bound;
+
+	private:
+		// graph slot of a variable, or inputCount() when the expression does not depend on it
+		std::size_t slotOf(const BasicVariable<Scalar>& var) const {
+			for (std::size_t k = 0; k < bound.size(); ++k) {
+				if (bound[k].initAddress == var.initAddress) return slots + k;
+			}
+			return inputCount();
+		}
+		template <std::size_t index>
+		std::size_t slotOf(const BasicIndexedVariable<Scalar, index>& var) const { return index < slots ? index : inputCount(); }
+
+		// values of the graph's input slots - variables that are not passed read zero, as in Variable
+		void bind(std::span<Scalar> inputs, std::span<const Scalar> values) const {
+			std::ranges::fill(inputs, Scalar(0));
+			std::copy_n(values.begin(), std::min(values.size(), slots), inputs.begin());
+		}
+		void bind(std::span<Scalar> inputs, std::convertible_to<const EvalVariable<Scalar>&> auto... args) const {
+			std::ranges::fill(inputs, Scalar(0));
+			for (std::size_t k = 0; k < bound.size(); ++k) {
+				([&](const EvalVariable<Scalar>& arg) {
+					if (arg.initAddress == bound[k].initAddress) inputs[slots + k] = arg.value;
+				}(args), ...);
+			}
+		}
+
+		Scalar evaluate(const auto&... args) const {
+			std::span<Scalar> buffer = scratch(inputCount() + graph->size());
+			std::span<Scalar> inputs = buffer.first(inputCount());
+			std::span<Scalar> values = buffer.last(graph->size());
+			bind(inputs, args...);
+			graph->evaluate(inputs, values);
+			return values[root];
+		}
+
+		// value of every node up to root, in any number type with the arithmetic and elementary functions of the
+		// graph ops - input(slot) gives the value of an input slot
+		template <typename T>
+		void walk(std::span<T> nodeValues, auto input) const {
+			using graph::Op;
+			std::span<const graph::Node<Scalar>> nodes = graph->nodes();
+			for (std::size_t i = 0; i <= root; ++i) {
+				const graph::Node<Scalar>& node = nodes[i];
+				switch (node.op) {
+				case Op::Constant: nodeValues[i] = T(node.payload); break;
+				case Op::Variable: nodeValues[i] = input(node.lhs); break;
+				case Op::Sum: nodeValues[i] = nodeValues[node.lhs] + nodeValues[node.rhs]; break;
+				case Op::Difference: nodeValues[i] = nodeValues[node.lhs] - nodeValues[node.rhs]; break;
+				case Op::Product: nodeValues[i] = nodeValues[node.lhs] * nodeValues[node.rhs]; break;
+				case Op::Quotient: nodeValues[i] = nodeValues[node.lhs] / nodeValues[node.rhs]; break;
+				case Op::Exp: nodeValues[i] = exp(nodeValues[node.lhs]); break;
+				case Op::Log: nodeValues[i] = log(nodeValues[node.lhs]); break;
+				case Op::Sin: nodeValues[i] = sin(nodeValues[node.lhs]); break;
+				case Op::Cos: nodeValues[i] = cos(nodeValues[node.lhs]); break;
+				case Op::Sqrt: nodeValues[i] = sqrt(nodeValues[node.lhs]); break;
+				case Op::Pow: nodeValues[i] = pow(nodeValues[node.lhs], node.payload); break;
+				}
+			}
+		}
+
+		// reverse pass over the graph in any number type walk() supports - nodeAdjoints and partials as in
+		// graph::Graph::gradient. The dual numbers of Hessian-vector products run the same rules as the typed nodes
+		template <typename T>
+		void sweep(std::span<const T> values, std::span<T> nodeAdjoints, std::span<T> partials) const {
+			using graph::Op;
+			std::span<const graph::Node<Scalar>> nodes = graph->nodes();
+			std::ranges::fill(nodeAdjoints, T(Scalar(0)));
+			std::ranges::fill(partials, T(Scalar(0)));
+			nodeAdjoints[root] = T(Scalar(1));
+
+			for (std::size_t i = root + 1; i-- > 0;) {
+				const graph::Node<Scalar>& node = nodes[i];
+				const T adjoint = nodeAdjoints[i];
+				T& lhs = nodeAdjoints[node.lhs];
+				switch (node.op) {
+				case Op::Constant: break;
+				case Op::Variable: partials[node.lhs] = partials[node.lhs] + adjoint; break;
+				case Op::Sum:
+					lhs = lhs + adjoint;
+					nodeAdjoints[node.rhs] = nodeAdjoints[node.rhs] + adjoint;
+					break;
+				case Op::Difference:
+					lhs = lhs + adjoint;
+					nodeAdjoints[node.rhs] = nodeAdjoints[node.rhs] - adjoint;
+					break;
+				case Op::Product:
+					lhs = lhs + adjoint * values[node.rhs];
+					nodeAdjoints[node.rhs] = nodeAdjoints[node.rhs] + adjoint * values[node.lhs];
+					break;
+				case Op::Quotient:
+					lhs = lhs + adjoint / values[node.rhs];
+					nodeAdjoints[node.rhs] = nodeAdjoints[node.rhs] - adjoint * values[i] / values[node.rhs];
+					break;
+				case Op::Exp: lhs = lhs + adjoint * values[i]; break;
+				case Op::Log: lhs = lhs + adjoint / values[node.lhs]; break;
+				case Op::Sin: lhs = lhs + adjoint * cos(values[node.lhs]); break;
+				case Op::Cos: lhs = lhs - adjoint * sin(values[node.lhs]); break;
+				case Op::Sqrt: lhs = lhs + adjoint * T(Scalar(0.5)) / values[i]; break;
+				case Op::Pow: lhs = lhs + adjoint * T(node.payload) * pow(values[node.lhs], node.payload - Scalar(1)); break;
+				}
+			}
+		}
+
+		// input slots of a walk from values per IndexedVariable - bound variables read zero
+		template <typename T>
+		static auto indexedInputs(std::span<const T> values) {
+			return [values](std::size_t slot) { return slot < std::min(slots, values.size()) ? values[slot] : T(Scalar(0)); };
+		}
+
+		// per-thread buffer, valid until the next call on this thread with the same T
+		template <typename T = Scalar>
+		static std::span<T> scratch(std::size_t size) {
+			thread_local std::vector<T> buffer;
+			if (buffer.size() < size) buffer.resize(size);
+			return {buffer.data(), size};
+		}
+	};
+
+	template <typename Scalar, std::size_t slots>
+	using BasicErased = Expression<Scalar, ExprType::Erased, Index<slots>>;
+
+	template <typename Scalar, std::size_t slots>
+	constexpr std::size_t indexedSlots<BasicErased<Scalar, slots>> = slots;
+	// an erased node's bound variables are only known at run time
+	template <typename Scalar, std::size_t slots, std::size_t index>
+	constexpr bool dependsOn<BasicErased<Scalar, slots>, Index<index>> = index < slots;
+	template <typename Scalar, std::size_t slots>
+	constexpr bool dependsOn<BasicErased<Scalar, slots>> = true;
+
+	// elementary function of an expression - constant operands are evaluated right away
+	template <ExprType function, typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto elementaryOf(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (exprType == ExprType::Constant) return BasicConstant<Scalar>{elementary::value<functionOf(function)>(Scalar(operand.value))};
+		else return Expression<Scalar, function, Expression<Scalar, exprType, Ts...>>{operand};
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto exp(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicZeroExpr<Scalar>>) return BasicOneExpr<Scalar>{};
+		else return elementaryOf<ExprType::Exp>(operand);
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto log(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicOneExpr<Scalar>>) return BasicZeroExpr<Scalar>{};
+		else return elementaryOf<ExprType::Log>(operand);
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto sin(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicZeroExpr<Scalar>>) return BasicZeroExpr<Scalar>{};
+		else return elementaryOf<ExprType::Sin>(operand);
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto cos(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicZeroExpr<Scalar>>) return BasicOneExpr<Scalar>{};
+		else return elementaryOf<ExprType::Cos>(operand);
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto sqrt(const Expression<Scalar, exprType, Ts...>& operand) {
+		using Type = Expression<Scalar, exprType, Ts...>;
+
+		if constexpr (std::is_same_v<Type, BasicZeroExpr<Scalar>> || std::is_same_v<Type, BasicOneExpr<Scalar>>) return operand;
+		else return elementaryOf<ExprType::Sqrt>(operand);
+	}
+
+	// expression raised to a constant power
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto pow(const Expression<Scalar, exprType, Ts...>& base, std::type_identity_t<Scalar> exponent) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicOneExpr<Scalar>>) return base;
+		else if constexpr (exprType == ExprType::Constant) return BasicConstant<Scalar>{elementary::pow(Scalar(base.value), exponent)};
+		else return Expression<Scalar, ExprType::Pow, Expression<Scalar, exprType, Ts...>>{base, exponent};
+	}
+
+	// expression raised to an expression power, as exp(exponent * log(base)) - defined for positive bases
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	constexpr auto pow(const Expression<Scalar, exprType1, Ts1...>& base, const Expression<Scalar, exprType2, Ts2...>& exponent) {
+		if constexpr (exprType2 == ExprType::Constant) return pow(base, Scalar(exponent.value));
+		else return exp(exponent * log(base));
+	}
+
+	// adjoint accumulator for variables bound by address - partials are kept in binding order
+	template <typename Scalar, std::size_t count>
+	struct BoundAdjoints {
+		constexpr void add(const BasicVariable<Scalar>& var, Scalar adjoint) {
+			for (std::size_t i = 0; i < count; ++i) {
+				if (bindings[i].initAddress == var.initAddress) {
+					partials[i] += adjoint;
+					return;
+				}
+			}
+		}
+
+		std::array<EvalVariable<Scalar>, count> bindings;
+		std::array<Scalar, count> partials{};
+	};
+
+	// adjoint accumulator for indexed variables - partials[index] receives d/dIndexedVariable<index>
+	template <typename Scalar>
+	struct IndexedAdjoints {
+		template <std::size_t index>
+		constexpr void add(const BasicIndexedVariable<Scalar, index>& var, Scalar adjoint) { partials[index] += adjoint; }
+
+		std::span<Scalar> partials;
+	};
+
+	// adjoint accumulator for indexed variables that writes every stride-th element - one row or column of a Jacobian
+	template <typename Scalar>
+	struct StridedAdjoints {
+		template <std::size_t index>
+		constexpr void add(const BasicIndexedVariable<Scalar, index>& var, Scalar adjoint) { partials[index * stride] += adjoint; }
+
+		Scalar* partials;
+		std::size_t stride;
+	};
+
+	// adjoint accumulator for Hessian-vector products - the adjoint pass runs on dual numbers whose tangent part
+	// is the derivative of the gradient along the direction, i.e. (H v)[index]
+	template <typename Scalar>
+	struct TangentAdjoints {
+		template <std::size_t index>
+		constexpr void add(const BasicIndexedVariable<Scalar, index>& var, const Dual<Scalar>& adjoint) {
+			product[index] += adjoint.derivative;
+			if (!partials.empty()) partials[index] += adjoint.value;
+		}
+
+		std::span<Scalar> product;
+		std::span<Scalar> partials;
+	};
+
+	// storage order of a Jacobian in a flat buffer - RowMajor keeps d rows[i] / d var[j] at i * columns + j,
+	// ColumnMajor at j * rows + i
+	enum class Layout : std::uint8_t {
+		RowMajor,
+		ColumnMajor
+	};
+
+	// gradient by reverse accumulation: one forward pass and one adjoint pass give every partial,
+	// returned in the order the variables are bound
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto gradient(const Expression<Scalar, exprType, Ts...>& expr, std::convertible_to<const EvalVariable<Scalar>&> auto... args) {
+		BoundAdjoints<Scalar, sizeof...(args)> adjoints{{args...}};
+		expr.backward(expr.forward(args...), Scalar(1), adjoints);
+		return adjoints.partials;
+	}
+
+	// gradient over indexed variables - writes d/dIndexedVariable<i> to partials[i] and returns the value of expr
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr Scalar gradient(const Expression<Scalar, exprType, Ts...>& expr,
+							  std::type_identity_t<std::span<const Scalar>> values, std::type_identity_t<std::span<Scalar>> partials) {
+		std::ranges::fill(partials, Scalar(0));
+		IndexedAdjoints<Scalar> adjoints{partials};
+		auto primal = expr.forward(values);
+		expr.backward(primal, Scalar(1), adjoints);
+		return primal.value;
+	}
+
+	// Hessian-vector product by forward-over-reverse: the forward pass carries the derivative of every node along
+	// direction, and the adjoint pass differentiates the gradient along it with the same node rules on dual numbers.
+	// product receives H * direction, partials (when non-empty) the gradient, at a small constant multiple of the
+	// cost of a gradient and without building second-derivative trees. Returns the value of expr
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr Scalar hessianVector(const Expression<Scalar, exprType, Ts...>& expr, std::type_identity_t<std::span<const Scalar>> values,
+								   std::type_identity_t<std::span<const Scalar>> direction, std::type_identity_t<std::span<Scalar>> product,
+								   std::type_identity_t<std::span<Scalar>> partials = {}) {
+		constexpr std::size_t slots = indexedSlots<Expression<Scalar, exprType, Ts...>>;
+
+		std::array<Dual<Scalar>, slots> seeded;
+		for (std::size_t slot = 0; slot < slots; ++slot) seeded[slot] = {values[slot], direction[slot]};
+
+		std::ranges::fill(product, Scalar(0));
+		std::ranges::fill(partials, Scalar(0));
+		TangentAdjoints<Scalar> adjoints{product, partials};
+		auto primal = expr.forward(std::span<const Dual<Scalar>>{seeded});
+		expr.backward(primal, Dual<Scalar>{1}, adjoints);
+		return primal.value.value;
+	}
+
+	// dense Hessian over indexed variables, one Hessian-vector product per column - hessian[i * n + j] holds
+	// d2 expr / dIndexedVariable<i> dIndexedVariable<j> for n = values.size(). Returns the value of expr
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr Scalar hessian(const Expression<Scalar, exprType, Ts...>& expr, std::type_identity_t<std::span<const Scalar>> values,
+							 std::type_identity_t<std::span<Scalar>> hessian) {
+		constexpr std::size_t slots = indexedSlots<Expression<Scalar, exprType, Ts...>>;
+		const std::size_t n = values.size();
+
+		std::ranges::fill(hessian.first(n * n), Scalar(0));
+		if constexpr (slots == 0) return expr(values);
+
+		// the Hessian is symmetric, so column j of H is also row j
+		std::array<Scalar, slots> direction{};
+		Scalar value = 0;
+		for (std::size_t column = 0; column < slots; ++column) {
+			direction[column] = 1;
+			value = hessianVector(expr, values, direction, hessian.subspan(column * n, slots));
+			direction[column] = 0;
+		}
+		return value;
+	}
+
+	// Jacobian of a system of expressions by reverse accumulation - each row costs one forward and one adjoint pass,
+	// with the forward records reused by the adjoint pass. Columns follow the order the variables are bound;
+	// returns the value of every row
+	template <typename First, typename... Rest>
+	constexpr auto jacobian(const std::tuple<First, Rest...>& rows, std::span<ScalarOfT<First>> out, Layout layout,
+							std::convertible_to<const EvalVariable<ScalarOfT<First>>&> auto... args) {
+		using Scalar = ScalarOfT<First>;
+		constexpr std::size_t rowCount = 1 + sizeof...(Rest);
+		constexpr std::size_t columnCount = sizeof...(args);
+
+		std::array<Scalar, rowCount> values;
+		std::size_t row = 0;
+		std::apply([&](const auto&... exprs) {
+			([&](const auto& expr) {
+				BoundAdjoints<Scalar, columnCount> adjoints{{args...}};
+				auto primal = expr.forward(args...);
+				expr.backward(primal, Scalar(1), adjoints);
+
+				values[row] = primal.value;
+				for (std::size_t column = 0; column < columnCount; ++column) {
+					out[layout == Layout::RowMajor ? row * columnCount + column : column * rowCount + row] = adjoints.partials[column];
+				}
+				++row;
+			}(exprs), ...);
+		}, rows);
+		return values;
+	}
+
+	// Jacobian over indexed variables - column j holds d/dIndexedVariable<j> for every j < values.size().
+	// Adjoints accumulate straight into out; returns the value of every row
+	template <typename First, typename... Rest>
+	constexpr auto jacobian(const std::tuple<First, Rest...>& rows, std::span<const ScalarOfT<First>> values,
+							std::span<ScalarOfT<First>> out, Layout layout) {
+		using Scalar = ScalarOfT<First>;
+		constexpr std::size_t rowCount = 1 + sizeof...(Rest);
+		const std::size_t columnCount = values.size();
+
+		std::ranges::fill(out.first(rowCount * columnCount), Scalar(0));
+		std::array<Scalar, rowCount> rowValues;
+		std::size_t row = 0;
+		std::apply([&](const auto&... exprs) {
+			([&](const auto& expr) {
+				StridedAdjoints<Scalar> adjoints = layout == Layout::RowMajor
+					? StridedAdjoints<Scalar>{out.data() + row * columnCount, 1}
+					: StridedAdjoints<Scalar>{out.data() + row, rowCount};
+				auto primal = expr.forward(values);
+				expr.backward(primal, Scalar(1), adjoints);
+
+				rowValues[row++] = primal.value;
+			}(exprs), ...);
+		}, rows);
+		return rowValues;
+	}
+
+	// vector forward mode over indexed variables - one forward pass carries count directions at once, with
+	// directions[i][d] the component of direction d along IndexedVariable<i>. Returns the value of expr and its
+	// derivative along every direction
+	template <std::size_t count, typename Scalar, ExprType exprType, typename... Ts>
+	constexpr VectorDual<Scalar, count> directionalDerivatives(const Expression<Scalar, exprType, Ts...>& expr,
+															   std::type_identity_t<std::span<const Scalar>> values,
+															   std::type_identity_t<std::span<const std::array<Scalar, count>>> directions) {
+		constexpr std::size_t slots = indexedSlots<Expression<Scalar, exprType, Ts...>>;
+
+		std::array<VectorDual<Scalar, count>, slots> seeded;
+		for (std::size_t slot = 0; slot < slots; ++slot) {
+			seeded[slot].value = values[slot];
+			seeded[slot].derivatives = directions[slot];
+		}
+		return expr(std::span<const VectorDual<Scalar, count>>{seeded});
+	}
+
+	// gradient over indexed variables by vector forward mode - partials are seeded count at a time, so n variables
+	// take ceil(n / count) forward passes and no adjoint pass. Writes d/dIndexedVariable<i> to partials[i] and
+	// returns the value of expr
+	template <std::size_t count, typename Scalar, ExprType exprType, typename... Ts>
+	constexpr Scalar forwardGradient(const Expression<Scalar, exprType, Ts...>& expr, std::type_identity_t<std::span<const Scalar>> values,
+									 std::type_identity_t<std::span<Scalar>> partials) {
+		constexpr std::size_t slots = indexedSlots<Expression<Scalar, exprType, Ts...>>;
+
+		std::ranges::fill(partials, Scalar(0));
+		std::array<VectorDual<Scalar, count>, slots> seeded;
+		for (std::size_t slot = 0; slot < slots; ++slot) seeded[slot].value = values[slot];
+
+		if constexpr (slots == 0) return expr(values);
+		Scalar value = 0;
+		for (std::size_t first = 0; first < slots; first += count) {
+			for (std::size_t slot = 0; slot < slots; ++slot) {
+				seeded[slot].derivatives.fill(Scalar(0));
+				if (slot >= first && slot < first + count) seeded[slot].derivatives[slot - first] = 1;
+			}
+			VectorDual<Scalar, count> result = expr(std::span<const VectorDual<Scalar, count>>{seeded});
+			for (std::size_t d = 0; d < count && first + d < std::min(slots, partials.size()); ++d) partials[first + d] = result.derivatives[d];
+			value = result.value;
+		}
+		return value;
+	}
+
+	// evaluates expr over structure-of-arrays inputs - columns[i] holds the samples of IndexedVariable<i>.
+	// One vector of lanes is evaluated per tree walk, with a scalar tail
 	template <ExprType exprType, typename... Ts>
-	constexpr auto operator/(float lhs, const Expression<exprType, Ts...>& rhs) { return Expression<ExprType::Quotient, Constant, Expression<exprType, Ts...>>{lhs, rhs}; }
+	void evaluateBatch(const Expression<float, exprType, Ts...>& expr, std::span<const std::span<const float>> columns, std::span<float> out) {
+		constexpr std::size_t slots = indexedSlots<Expression<float, exprType, Ts...>>;
+
+		std::size_t i = 0;
+		for (; i + simd::FloatPack::width <= out.size(); i += simd::FloatPack::width) {
+			std::array<simd::FloatPack, slots> lanes;
+			for (std::size_t slot = 0; slot < slots; ++slot) lanes[slot] = simd::FloatPack::load(columns[slot].data() + i);
+			expr(std::span<const simd::FloatPack>{lanes}).store(out.data() + i);
+		}
+		for (; i < out.size(); ++i) {
+			std::array<float, slots> values;
+			for (std::size_t slot = 0; slot < slots; ++slot) values[slot] = columns[slot][i];
+			out[i] = expr(std::span<const float>{values});
+		}
+	}
+
+	// global operators with scalars - the scalar converts to the expression's precision
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator+(const Expression<Scalar, exprType, Ts...>& lhs, std::type_identity_t<Scalar> rhs) { return Expression<Scalar, ExprType::Sum, Expression<Scalar, exprType, Ts...>, BasicConstant<Scalar>>{lhs, rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator+(std::type_identity_t<Scalar> lhs, const Expression<Scalar, exprType, Ts...>& rhs) { return Expression<Scalar, ExprType::Sum, BasicConstant<Scalar>, Expression<Scalar, exprType, Ts...>>{lhs, rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator-(const Expression<Scalar, exprType, Ts...>& lhs, std::type_identity_t<Scalar> rhs) { return Expression<Scalar, ExprType::Difference, Expression<Scalar, exprType, Ts...>, BasicConstant<Scalar>>{lhs, rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator-(std::type_identity_t<Scalar> lhs, const Expression<Scalar, exprType, Ts...>& rhs) { return Expression<Scalar, ExprType::Difference, BasicConstant<Scalar>, Expression<Scalar, exprType, Ts...>>{lhs, rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator*(const Expression<Scalar, exprType, Ts...>& lhs, std::type_identity_t<Scalar> rhs) { return Expression<Scalar, ExprType::Product, Expression<Scalar, exprType, Ts...>, BasicConstant<Scalar>>{lhs, rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator*(std::type_identity_t<Scalar> lhs, const Expression<Scalar, exprType, Ts...>& rhs) { return Expression<Scalar, ExprType::Product, BasicConstant<Scalar>, Expression<Scalar, exprType, Ts...>>{lhs, rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator/(const Expression<Scalar, exprType, Ts...>& lhs, std::type_identity_t<Scalar> rhs) { return Expression<Scalar, ExprType::Quotient, Expression<Scalar, exprType, Ts...>, BasicConstant<Scalar>>{lhs, rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator/(std::type_identity_t<Scalar> lhs, const Expression<Scalar, exprType, Ts...>& rhs) { return Expression<Scalar, ExprType::Quotient, BasicConstant<Scalar>, Expression<Scalar, exprType, Ts...>>{lhs, rhs}; }
+
+	// adds the nodes of expr to graph and returns its root. IndexedVariable<i> reads inputs[i]; variables bound by
+	// address read inputs[firstBoundSlot + position in bound]. Throws std::invalid_argument for a variable that is
+	// neither
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	graph::NodeId appendTo(graph::Graph<Scalar>& graph, const Expression<Scalar, exprType, Ts...>& expr,
+						   std::span<const BasicVariable<Scalar>* const> bound, std::size_t firstBoundSlot) {
+		auto boundSlot = [&](const BasicVariable<Scalar>& var) {
+			for (std::size_t k = 0; k < bound.size(); ++k) {
+				if (bound[k]->initAddress == var.initAddress) return graph.variable(static_cast<std::uint32_t>(firstBoundSlot + k));
+			}
+			throw std::invalid_argument("expression uses a variable that was not bound for lowering");
+		};
+
+		if constexpr (exprType == ExprType::Constant) return graph.constant(Scalar(expr.value));
+		else if constexpr (requires { expr.initAddress; }) return boundSlot(expr);
+		else if constexpr (exprType == ExprType::Variable) {
+			return graph.variable(static_cast<std::uint32_t>(indexedSlots<Expression<Scalar, exprType, Ts...>> - 1));
+		}
+		else if constexpr (exprType == ExprType::Erased) {
+			std::vector<graph::NodeId> inputNodes;
+			for (std::size_t slot = 0; slot < indexedSlots<Expression<Scalar, exprType, Ts...>>; ++slot) {
+				inputNodes.push_back(graph.variable(static_cast<std::uint32_t>(slot)));
+			}
+			for (const BasicVariable<Scalar>& var : expr.bound) inputNodes.push_back(boundSlot(var));
+			return graph.append(*expr.graph, expr.root, inputNodes);
+		}
+		else if constexpr (exprType == ExprType::Pow) return graph.pow(appendTo(graph, expr.operand, bound, firstBoundSlot), expr.exponent);
+		else if constexpr (requires { expr.operand; }) return graph.add(graph::opOf(exprType), appendTo(graph, expr.operand, bound, firstBoundSlot));
+		else {
+			graph::NodeId lhs = appendTo(graph, expr.lhs, bound, firstBoundSlot);
+			graph::NodeId rhs = appendTo(graph, expr.rhs, bound, firstBoundSlot);
+			return graph.add(graph::opOf(exprType), lhs, rhs);
+		}
+	}
+
+	// distinct variables bound by address in expr, in order of first appearance
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	void collectBound(const Expression<Scalar, exprType, Ts...>& expr, std::vector<BasicVariable<Scalar>>& bound) {
+		auto add = [&](const BasicVariable<Scalar>& var) {
+			for (const BasicVariable<Scalar>& known : bound) {
+				if (known.initAddress == var.initAddress) return;
+			}
+			bound.push_back(var);
+		};
+
+		if constexpr (requires { expr.initAddress; }) add(expr);
+		else if constexpr (exprType == ExprType::Erased) {
+			for (const BasicVariable<Scalar>& var : expr.bound) add(var);
+		}
+		else if constexpr (requires { expr.operand; }) collectBound(expr.operand, bound);
+		else if constexpr (requires { expr.lhs; }) {
+			collectBound(expr.lhs, bound);
+			collectBound(expr.rhs, bound);
+		}
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto capped(const Expression<Scalar, exprType, Ts...>& expr) {
+		using Expr = Expression<Scalar, exprType, Ts...>;
+		if constexpr (cse::nodeCount<Expr> <= AUTODIFF_ERASURE_NODES) return expr;
+		else {
+			constexpr std::size_t slots = indexedSlots<Expr>;
+			std::vector<BasicVariable<Scalar>> bound;
+			collectBound(expr, bound);
+			std::vector<const BasicVariable<Scalar>*> addresses;
+			for (const BasicVariable<Scalar>& var : bound) addresses.push_back(&var);
+
+			graph::Graph<Scalar> lowered;
+			graph::NodeId root = appendTo(lowered, expr, std::span<const BasicVariable<Scalar>* const>{addresses}, slots);
+			return BasicErased<Scalar, slots>::erasedOf(lowered, root, std::move(bound));
+		}
+	}
 
 
 
@@ -0,0 +1,223 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "MultiVarDiff.h"
+#include "SingleVarDiff.h"
+
+// multithreaded batch evaluation of singleVarDiff / multiVarDiff expressions
+namespace parallel {
+
+	// points per chunk - input and output of a chunk stay resident in L2
+	constexpr std::size_t defaultChunkSize = 4096;
+
+	// Work-stealing pool for data-parallel loops. Each worker owns a contiguous range of chunks and takes
+	// from its front; a worker that runs dry steals from the back of another worker's range
+	class ThreadPool {
+	public:
+		// throws std::invalid_argument for a threadCount of zero - the calling thread is always one of the workers
+		explicit ThreadPool(std::size_t threadCount = std::max(1u, std::thread::hardware_concurrency()))
+			: queues(std::make_unique<Queue[]>(threadCount)), workerCount(threadCount) {
+			if (workerCount == 0) throw std::invalid_argument("a thread pool needs at least one thread");
+			// the calling thread acts as worker 0
+			for (std::size_t worker = 1; worker < workerCount; ++worker) {
+				threads.emplace_back([this, worker] { workerLoop(worker); });
+			}
+		}
+
+		~ThreadPool() {
+			{
+				std::lock_guard lock(mutex);
+				stopping = true;
+			}
+			wake.notify_all();
+		}
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		std::size_t size() const { return workerCount; }
+
+		// calls task(begin, end) for every chunk of [0, count) and returns once all chunks are done.
+		// Not reentrant - task must not call forEachChunk on the same pool. Throws std::invalid_argument for a zero chunkSize
+		void forEachChunk(std::size_t count, std::size_t chunkSize, const std::function<void(std::size_t, std::size_t)>& task) {
+			if (chunkSize == 0) throw std::invalid_argument("chunk size must be at least 1");
+			const std::size_t chunks = (count + chunkSize - 1) / chunkSize;
+			if (chunks == 0) return;
+
+			for (std::size_t worker = 0; worker < workerCount; ++worker) {
+				std::lock_guard lock(queues[worker].mutex);
+				queues[worker].front = worker * chunks / workerCount;
+				queues[worker].back = (worker + 1) * chunks / workerCount;
+			}
+
+			job = [&task, count, chunkSize](std::size_t chunk) {
+				std::size_t begin = chunk * chunkSize;
+				task(begin, std::min(count, begin + chunkSize));
+			};
+			failure = nullptr;
+
+			{
+				std::lock_guard lock(mutex);
+				++generation;
+				busy = workerCount - 1;
+			}
+			wake.notify_all();
+
+			drain(0);
+
+			std::unique_lock lock(mutex);
+			done.wait(lock, [this] { return busy == 0; });
+			job = nullptr;
+			if (failure) std::rethrow_exception(failure);
+		}
+
+	private:
+		struct alignas(64) Queue {
+			std::mutex mutex;
+			std::size_t front = 0;
+			std::size_t back = 0;
+		};
+
+		void workerLoop(std::size_t worker) {
+			std::size_t seen = 0;
+			while (true) {
+				{
+					std::unique_lock lock(mutex);
+					wake.wait(lock, [&] { return stopping || generation != seen; });
+					if (stopping) return;
+					seen = generation;
+				}
+
+				drain(worker);
+
+				std::lock_guard lock(mutex);
+				if (--busy == 0) done.notify_one();
+			}
+		}
+
+		// runs chunks until every queue is empty - chunks are never added during a loop, so one
+		// failed pass over all queues means the loop is finished
+		void drain(std::size_t worker) {
+			std::size_t chunk;
+			while (pop(worker, chunk) || steal(worker, chunk)) {
+				try {
+					job(chunk);
+				}
+				catch (...) {
+					std::lock_guard lock(mutex);
+					if (!failure) failure = std::current_exception();
+				}
+			}
+		}
+
+		bool pop(std::size_t worker, std::size_t& chunk) {
+			Queue& queue = queues[worker];
+			std::lock_guard lock(queue.mutex);
+			if (queue.front == queue.back) return false;
+			chunk = queue.front++;
+			return true;
+		}
+
+		bool steal(std::size_t thief, std::size_t& chunk) {
+			for (std::size_t offset = 1; offset < workerCount; ++offset) {
+				Queue& victim = queues[(thief + offset) % workerCount];
+				std::lock_guard lock(victim.mutex);
+				if (victim.front != victim.back) {
+					chunk = --victim.back;
+					return true;
+				}
+			}
+			return false;
+		}
+
+		std::unique_ptr<Queue[]> queues;
+		std::size_t workerCount;
+		std::function<void(std::size_t)> job;
+		std::exception_ptr failure;
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::condition_variable done;
+		std::size_t generation = 0;
+		std::size_t busy = 0;
+		bool stopping = false;
+
+		// declared last so the workers join before the state they use is destroyed
+		std::vector<std::jthread> threads;
+	};
+
+	// evaluates expr at every point of xs into out; when derivatives is non-empty, d/dx is written there too.
+	// The expression is shared read-only by all workers. Throws std::invalid_argument when out, or a non-empty
+	// derivatives, is shorter than xs
+	template <singleVarDiff::ExprType exprType, typename... Ts>
+	void evaluateBatch(ThreadPool& pool, const singleVarDiff::Expression<float, exprType, Ts...>& expr,
+					   std::span<const float> xs, std::span<float> out, std::span<float> derivatives = {},
+					   std::size_t chunkSize = defaultChunkSize) {
+		if (out.size() < xs.size()) throw std::invalid_argument("out shorter than xs");
+		if (!derivatives.empty() && derivatives.size() < xs.size()) throw std::invalid_argument("derivatives shorter than xs");
+
+		// the derivative is only built when it is asked for
+		std::optional<decltype(expr.dx())> dExpr;
+		if (!derivatives.empty()) dExpr.emplace(expr.dx());
+
+		pool.forEachChunk(xs.size(), chunkSize, [&](std::size_t begin, std::size_t end) {
+			auto chunkXs = xs.subspan(begin, end - begin);
+			singleVarDiff::evaluateBatch(expr, chunkXs, out.subspan(begin, end - begin));
+			if (dExpr) singleVarDiff::evaluateBatch(*dExpr, chunkXs, derivatives.subspan(begin, end - begin));
+		});
+	}
+
+	// evaluates expr over structure-of-arrays inputs (columns[i] holds the samples of IndexedVariable<i>) into out.
+	// When partials is non-empty, partials[i] receives d/dIndexedVariable<i> at every point. Throws
+	// std::invalid_argument unless columns, and a non-empty partials, have a column of at least out.size() for
+	// every IndexedVariable
+	template <multiVarDiff::ExprType exprType, typename... Ts>
+	void evaluateBatch(ThreadPool& pool, const multiVarDiff::Expression<float, exprType, Ts...>& expr,
+					   std::span<const std::span<const float>> columns, std::span<float> out,
+					   std::span<const std::span<float>> partials = {}, std::size_t chunkSize = defaultChunkSize) {
+		constexpr std::size_t slots = multiVarDiff::indexedSlots<multiVarDiff::Expression<float, exprType, Ts...>>;
+		if (columns.size() < slots) throw std::invalid_argument("columns needs one column per indexed variable");
+		for (std::span<const float> column : columns.first(slots)) {
+			if (column.size() < out.size()) throw std::invalid_argument("input column shorter than out");
+		}
+		if (!partials.empty()) {
+			if (partials.size() < slots) throw std::invalid_argument("partials needs one column per indexed variable");
+			for (std::span<float> column : partials.first(slots)) {
+				if (column.size() < out.size()) throw std::invalid_argument("partials column shorter than out");
+			}
+		}
+
+		// the partial derivatives are only built when they are asked for
+		auto derivatives = [&]<std::size_t... indices>(std::index_sequence<indices...>) {
+			return std::make_tuple(expr.dx(multiVarDiff::IndexedVariable<indices>{})...);
+		};
+		std::optional<decltype(derivatives(std::make_index_sequence<slots>{}))> dExprs;
+		if (!partials.empty()) dExprs.emplace(derivatives(std::make_index_sequence<slots>{}));
+
+		pool.forEachChunk(out.size(), chunkSize, [&](std::size_t begin, std::size_t end) {
+			std::array<std::span<const float>, slots> chunkColumns;
+			for (std::size_t slot = 0; slot < slots; ++slot) chunkColumns[slot] = columns[slot].subspan(begin, end - begin);
+
+			multiVarDiff::evaluateBatch(expr, chunkColumns, out.subspan(begin, end - begin));
+			if (dExprs) {
+				[&]<std::size_t... indices>(std::index_sequence<indices...>) {
+					(multiVarDiff::evaluateBatch(std::get<indices>(*dExprs), chunkColumns, partials[indices].subspan(begin, end - begin)), ...);
+				}(std::make_index_sequence<slots>{});
+			}
+		});
+	}
+
+}
@@ -0,0 +1,165 @@
+#pragma once
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include "Graph.h"
+
+namespace graph {
+
+	// Recursive-descent reader of expression text into a graph. Grammar, loosest binding first:
+	//   sum     = product (('+' | '-') product)*
+	//   product = unary (('*' | '/') unary)*
+	//   unary   = '-' unary | power
+	//   power   = primary ('^' unary)?
+	//   primary = number | variable | function '(' sum ')' | 'pow' '(' sum ',' sum ')' | '(' sum ')'
+	template <typename Scalar>
+	class Parser {
+	public:
+		Parser(Graph<Scalar>& graph, std::string_view text, std::span<const std::string> variables)
+			: graph(graph), text(text), variables(variables) {}
+
+		NodeId parse() {
+			// every declared variable gets its slot, used or not, so gradients have one partial per name
+			for (std::size_t slot = 0; slot < variables.size(); ++slot) graph.variable(static_cast<std::uint32_t>(slot));
+			NodeId root = sum();
+			skipSpace();
+			if (position != text.size()) fail("unexpected character");
+			return root;
+		}
+
+	private:
+		NodeId sum() {
+			NodeId lhs = product();
+			for (;;) {
+				if (accept('+')) lhs = graph.sum(lhs, product());
+				else if (accept('-')) lhs = graph.difference(lhs, product());
+				else return lhs;
+			}
+		}
+
+		NodeId product() {
+			NodeId lhs = unary();
+			for (;;) {
+				if (accept('*')) lhs = graph.product(lhs, unary());
+				else if (accept('/')) lhs = graph.quotient(lhs, unary());
+				else return lhs;
+			}
+		}
+
+		NodeId unary() {
+			if (accept('-')) {
+				NodeId operand = unary();
+				// negative literals stay constants, so 2^-1 is still a Pow node
+				const Node<Scalar>& node = graph.nodes()[operand];
+				if (node.op == Op::Constant) return graph.constant(-node.payload);
+				return graph.difference(graph.constant(0), operand);
+			}
+			return power();
+		}
+
+		NodeId power() {
+			NodeId base = primary();
+			if (!accept('^')) return base;
+			return raise(base, unary());
+		}
+
+		// constant exponents become Pow nodes, others exp(exponent * log(base)) as in singleVarDiff::pow
+		NodeId raise(NodeId base, NodeId exponent) {
+			const Node<Scalar>& node = graph.nodes()[exponent];
+			if (node.op == Op::Constant) return graph.pow(base, node.payload);
+			return graph.exp(graph.product(exponent, graph.log(base)));
+		}
+
+		NodeId primary() {
+			skipSpace();
+			if (accept('(')) {
+				NodeId inner = sum();
+				expect(')');
+				return inner;
+			}
+			if (position < text.size() && (isDigit(text[position]) || text[position] == '.')) return number();
+
+			std::string_view name = identifier();
+			if (name.empty()) fail("expected a number, variable or function");
+			for (std::size_t slot = 0; slot < variables.size(); ++slot) {
+				if (variables[slot] == name) return graph.variable(static_cast<std::uint32_t>(slot));
+			}
+
+			if (name == "pow") {
+				expect('(');
+				NodeId base = sum();
+				expect(',');
+				NodeId exponent = sum();
+				expect(')');
+				return raise(base, exponent);
+			}
+
+			Op op;
+			if (name == "exp") op = Op::Exp;
+			else if (name == "log") op = Op::Log;
+			else if (name == "sin") op = Op::Sin;
+			else if (name == "cos") op = Op::Cos;
+			else if (name == "sqrt") op = Op::Sqrt;
+			else fail("unknown name '" + std::string(name) + "'");
+			expect('(');
+			NodeId operand = sum();
+			expect(')');
+			return graph.add(op, operand);
+		}
+
+		NodeId number() {
+			double value = 0;
+			auto [end, error] = std::from_chars(text.data() + position, text.data() + text.size(), value);
+			if (error != std::errc{}) fail("malformed number");
+			position = end - text.data();
+			return graph.constant(Scalar(value));
+		}
+
+		std::string_view identifier() {
+			std::size_t start = position;
+			while (position < text.size() && (isLetter(text[position]) || (position > start && isDigit(text[position])))) ++position;
+			return text.substr(start, position - start);
+		}
+
+		static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+		static bool isLetter(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+
+		void skipSpace() {
+			while (position < text.size() && (text[position] == ' ' || text[position] == '\t' || text[position] == '\n' || text[position] == '\r')) ++position;
+		}
+
+		bool accept(char c) {
+			skipSpace();
+			if (position < text.size() && text[position] == c) {
+				++position;
+				return true;
+			}
+			return false;
+		}
+
+		void expect(char c) {
+			if (!accept(c)) fail(std::string("expected '") + c + "'");
+		}
+
+		[[noreturn]] void fail(const std::string& message) const {
+			throw std::invalid_argument(message + " at position " + std::to_string(position) + " of \"" + std::string(text) + "\"");
+		}
+
+		Graph<Scalar>& graph;
+		std::string_view text;
+		std::span<const std::string> variables;
+		std::size_t position = 0;
+	};
+
+	// parses text such as "x*y + sin(x)^2" into graph and returns its root - variables[i] reads inputs[i].
+	// Throws std::invalid_argument naming the offending position
+	template <typename Scalar>
+	NodeId parse(Graph<Scalar>& graph, std::string_view text, std::span<const std::string> variables) {
+		return Parser<Scalar>{graph, text, variables}.parse();
+	}
+
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+
+#if defined(__AVX512F__) || defined(__AVX__) || defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#endif
+
+// vector lanes shared by the batch evaluators of both differentiation namespaces
+namespace simd {
+
+	// group of floats evaluated together - one native vector register wide
+	struct FloatPack {
+#if defined(__AVX512F__)
+		using Native = __m512;
+		static constexpr std::size_t width = 16;
+
+		FloatPack() = default;
+		FloatPack(float x) : lanes(_mm512_set1_ps(x)) {}
+		explicit FloatPack(Native x) : lanes(x) {}
+
+		static FloatPack load(const float* src) { return FloatPack{_mm512_loadu_ps(src)}; }
+		void store(float* dst) const { _mm512_storeu_ps(dst, lanes); }
+
+		friend FloatPack operator+(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm512_add_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator-(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm512_sub_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator*(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm512_mul_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator/(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm512_div_ps(lhs.lanes, rhs.lanes)}; }
+#elif defined(__AVX__)
+		using Native = __m256;
+		static constexpr std::size_t width = 8;
+
+		FloatPack() = default;
+		FloatPack(float x) : lanes(_mm256_set1_ps(x)) {}
+		explicit FloatPack(Native x) : lanes(x) {}
+
+		static FloatPack load(const float* src) { return FloatPack{_mm256_loadu_ps(src)}; }
+		void store(float* dst) const { _mm256_storeu_ps(dst, lanes); }
+
+		friend FloatPack operator+(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm256_add_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator-(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm256_sub_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator*(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm256_mul_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator/(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm256_div_ps(lhs.lanes, rhs.lanes)}; }
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+		using Native = __m128;
+		static constexpr std::size_t width = 4;
+
+		FloatPack() = default;
+		FloatPack(float x) : lanes(_mm_set1_ps(x)) {}
+		explicit FloatPack(Native x) : lanes(x) {}
+
+		static FloatPack load(const float* src) { return FloatPack{_mm_loadu_ps(src)}; }
+		void store(float* dst) const { _mm_storeu_ps(dst, lanes); }
+
+		friend FloatPack operator+(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm_add_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator-(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm_sub_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator*(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm_mul_ps(lhs.lanes, rhs.lanes)}; }
+		friend FloatPack operator/(FloatPack lhs, FloatPack rhs) { return FloatPack{_mm_div_ps(lhs.lanes, rhs.lanes)}; }
+#else
+		// no known vector unit - plain lanes the optimizer may still vectorize
+		struct Native { float x[4]; };
+		static constexpr std::size_t width = 4;
+
+		FloatPack() = default;
+		FloatPack(float x) : lanes{{x, x, x, x}} {}
+		explicit FloatPack(Native x) : lanes(x) {}
+
+		static FloatPack load(const float* src) { return FloatPack{Native{{src[0], src[1], src[2], src[3]}}}; }
+		void store(float* dst) const { for (std::size_t i = 0; i < width; ++i) dst[i] = lanes.x[i]; }
+
+		friend FloatPack operator+(FloatPack lhs, FloatPack rhs) { for (std::size_t i = 0; i < width; ++i) lhs.lanes.x[i] += rhs.lanes.x[i]; return lhs; }
+		friend FloatPack operator-(FloatPack lhs, FloatPack rhs) { for (std::size_t i = 0; i < width; ++i) lhs.lanes.x[i] -= rhs.lanes.x[i]; return lhs; }
+		friend FloatPack operator*(FloatPack lhs, FloatPack rhs) { for (std::size_t i = 0; i < width; ++i) lhs.lanes.x[i] *= rhs.lanes.x[i]; return lhs; }
+		friend FloatPack operator/(FloatPack lhs, FloatPack rhs) { for (std::size_t i = 0; i < width; ++i) lhs.lanes.x[i] /= rhs.lanes.x[i]; return lhs; }
+#endif
+
+		Native lanes;
+	};
+
+	// applies f to every lane - the elementary functions have no vector instruction, so each lane calls the scalar routine
+	template <typename F>
+	FloatPack lanewise(const FloatPack& x, F f) {
+		float lanes[FloatPack::width];
+		x.store(lanes);
+		for (float& lane : lanes) lane = f(lane);
+		return FloatPack::load(lanes);
+	}
+
+	inline FloatPack exp(const FloatPack& x) { return lanewise(x, [](float lane) { return std::exp(lane); }); }
+	inline FloatPack log(const FloatPack& x) { return lanewise(x, [](float lane) { return std::log(lane); }); }
+	inline FloatPack sin(const FloatPack& x) { return lanewise(x, [](float lane) { return std::sin(lane); }); }
+	inline FloatPack cos(const FloatPack& x) { return lanewise(x, [](float lane) { return std::cos(lane); }); }
+	inline FloatPack sqrt(const FloatPack& x) { return lanewise(x, [](float lane) { return std::sqrt(lane); }); }
+	inline FloatPack pow(const FloatPack& x, const FloatPack& exponent) {
+		float exponents[FloatPack::width];
+		exponent.store(exponents);
+		std::size_t i = 0;
+		return lanewise(x, [&](float lane) { return std::pow(lane, exponents[i++]); });
+	}
+
+}
@@ -1,5 +1,20 @@
 #pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
 #include <type_traits>
+#include <vector>
+#include "CommonSubexpressions.h"
+#include "Elementary.h"
+#include "Graph.h"
+#include "Simd.h"
+
+// derivatives whose expression type would exceed this many nodes are erased into a graph - see ExprType::Erased
+#ifndef AUTODIFF_ERASURE_NODES
+#define AUTODIFF_ERASURE_NODES 128
+#endif
 
 // implements differentiation by single variable
 namespace singleVarDiff {
@@ -10,180 +25,658 @@ namespace singleVarDiff {
 		Sum,
 		Difference,
 		Product,
-		Quotient
+		Quotient,
+		Exp,
+		Log,
+		Sin,
+		Cos,
+		Sqrt,
+		Pow,
+		Erased		// structure held in a graph::Graph rather than in the type
 	};
 
+	// elementary function nodes that share one implementation - Pow carries an exponent and is separate
+	constexpr bool isElementary(ExprType exprType) { return exprType >= ExprType::Exp && exprType <= ExprType::Sqrt; }
+
+	constexpr elementary::Function functionOf(ExprType exprType) {
+		switch (exprType) {
+		case ExprType::Exp: return elementary::Function::Exp;
+		case ExprType::Log: return elementary::Function::Log;
+		case ExprType::Sin: return elementary::Function::Sin;
+		case ExprType::Cos: return elementary::Function::Cos;
+		default: return elementary::Function::Sqrt;
+		}
+	}
+
 	struct Zero {};
 	struct One {};
 
-	template <ExprType exprType, typename... Ts> struct Expression;
-
-	// Constant
-	template <>
-	struct Expression<ExprType::Constant, Zero> {
-		constexpr float operator()(float x) { return 0; }
-		constexpr auto dx() { return Expression<ExprType::Constant, Zero>{}; }
-		static constexpr float value = 0;
+	// value and derivative of an expression at a point, propagated together by evalDual
+	template <typename Scalar>
+	struct Dual {
+		Scalar value;
+		Scalar derivative;
 	};
-	using ZeroExpr = Expression<ExprType::Constant, Zero>;
 
-	template <>
-	struct Expression<ExprType::Constant, One> {
-		constexpr float operator()(float x) { return 1; }
-		constexpr auto dx() { return Expression<ExprType::Constant, Zero>{}; }
-		static constexpr float value = 1;
+	// truncated Taylor series of an expression at a point, propagated by evalTaylor - coefficients[k] is the k-th
+	// derivative divided by k!. Every operation costs O(order^2), so all derivatives up to order come from one pass
+	// over the expression instead of order nested dx() types
+	template <typename Scalar, std::size_t order>
+	struct Taylor {
+		static constexpr Taylor constant(Scalar value) { return {{value}}; }
+		static constexpr Taylor variable(Scalar x) {
+			Taylor series{{x}};
+			if constexpr (order > 0) series.coefficients[1] = 1;
+			return series;
+		}
+
+		// the k-th derivative, k! * coefficients[k]
+		constexpr Scalar derivative(std::size_t k) const {
+			Scalar factorial = 1;
+			for (std::size_t i = 2; i <= k; ++i) factorial *= Scalar(i);
+			return coefficients[k] * factorial;
+		}
+
+		friend constexpr Taylor operator+(const Taylor& lhs, const Taylor& rhs) {
+			Taylor sum;
+			for (std::size_t k = 0; k <= order; ++k) sum.coefficients[k] = lhs.coefficients[k] + rhs.coefficients[k];
+			return sum;
+		}
+		friend constexpr Taylor operator-(const Taylor& lhs, const Taylor& rhs) {
+			Taylor difference;
+			for (std::size_t k = 0; k <= order; ++k) difference.coefficients[k] = lhs.coefficients[k] - rhs.coefficients[k];
+			return difference;
+		}
+		friend constexpr Taylor operator*(const Taylor& lhs, const Taylor& rhs) {
+			Taylor product;
+			for (std::size_t k = 0; k <= order; ++k) {
+				for (std::size_t j = 0; j <= k; ++j) product.coefficients[k] += lhs.coefficients[j] * rhs.coefficients[k - j];
+			}
+			return product;
+		}
+		// solves lhs = quotient * rhs for one coefficient after the other
+		friend constexpr Taylor operator/(const Taylor& lhs, const Taylor& rhs) {
+			Taylor quotient;
+			for (std::size_t k = 0; k <= order; ++k) {
+				Scalar sum = lhs.coefficients[k];
+				for (std::size_t j = 1; j <= k; ++j) sum -= rhs.coefficients[j] * quotient.coefficients[k - j];
+				quotient.coefficients[k] = sum / rhs.coefficients[0];
+			}
+			return quotient;
+		}
+
+		std::array<Scalar, order + 1> coefficients{};
 	};
-	using OneExpr = Expression<ExprType::Constant, One>;
 
-	template <>
-	struct Expression<ExprType::Constant> {
-		constexpr float operator()(float x) { return value; }
-		constexpr auto dx() { return Expression<ExprType::Constant, Zero>{}; }
-		float value;
+	// series of elementary functions by the recurrences that follow from w' = f'(u) u', e.g. w' = w u' for exp
+	template <typename Scalar, std::size_t order>
+	constexpr Taylor<Scalar, order> exp(const Taylor<Scalar, order>& u) {
+		Taylor<Scalar, order> w;
+		w.coefficients[0] = elementary::value<elementary::Function::Exp>(u.coefficients[0]);
+		for (std::size_t k = 1; k <= order; ++k) {
+			Scalar sum = 0;
+			for (std::size_t j = 1; j <= k; ++j) sum += Scalar(j) * u.coefficients[j] * w.coefficients[k - j];
+			w.coefficients[k] = sum / Scalar(k);
+		}
+		return w;
+	}
+
+	template <typename Scalar, std::size_t order>
+	constexpr Taylor<Scalar, order> log(const Taylor<Scalar, order>& u) {
+		Taylor<Scalar, order> w;
+		w.coefficients[0] = elementary::value<elementary::Function::Log>(u.coefficients[0]);
+		for (std::size_t k = 1; k <= order; ++k) {
+			Scalar sum = 0;
+			for (std::size_t j = 1; j < k; ++j) sum += Scalar(j) * w.coefficients[j] * u.coefficients[k - j];
+			w.coefficients[k] = (u.coefficients[k] - sum / Scalar(k)) / u.coefficients[0];
+		}
+		return w;
+	}
+
+	// sine and cosine series of u - each recurrence reads the other
+	template <typename Scalar, std::size_t order>
+	constexpr std::array<Taylor<Scalar, order>, 2> sinCos(const Taylor<Scalar, order>& u) {
+		Taylor<Scalar, order> s;
+		Taylor<Scalar, order> c;
+		s.coefficients[0] = elementary::value<elementary::Function::Sin>(u.coefficients[0]);
+		c.coefficients[0] = elementary::value<elementary::Function::Cos>(u.coefficients[0]);
+		for (std::size_t k = 1; k <= order; ++k) {
+			Scalar sinSum = 0;
+			Scalar cosSum = 0;
+			for (std::size_t j = 1; j <= k; ++j) {
+				sinSum += Scalar(j) * u.coefficients[j] * c.coefficients[k - j];
+				cosSum += Scalar(j) * u.coefficients[j] * s.coefficients[k - j];
+			}
+			s.coefficients[k] = sinSum / Scalar(k);
+			c.coefficients[k] = -cosSum / Scalar(k);
+		}
+		return {s, c};
+	}
+
+	template <typename Scalar, std::size_t order>
+	constexpr Taylor<Scalar, order> sin(const Taylor<Scalar, order>& u) { return sinCos(u)[0]; }
+
+	template <typename Scalar, std::size_t order>
+	constexpr Taylor<Scalar, order> cos(const Taylor<Scalar, order>& u) { return sinCos(u)[1]; }
+
+	template <typename Scalar, std::size_t order>
+	constexpr Taylor<Scalar, order> sqrt(const Taylor<Scalar, order>& u) {
+		Taylor<Scalar, order> w;
+		w.coefficients[0] = elementary::value<elementary::Function::Sqrt>(u.coefficients[0]);
+		for (std::size_t k = 1; k <= order; ++k) {
+			Scalar sum = u.coefficients[k];
+			for (std::size_t j = 1; j < k; ++j) sum -= w.coefficients[j] * w.coefficients[k - j];
+			w.coefficients[k] = sum / (2 * w.coefficients[0]);
+		}
+		return w;
+	}
+
+	// the recurrence divides by u(x), so at u(x) = 0 whole exponents are taken by repeated squaring instead
+	template <typename Scalar, std::size_t order>
+	constexpr Taylor<Scalar, order> pow(const Taylor<Scalar, order>& u, std::type_identity_t<Scalar> exponent) {
+		if (u.coefficients[0] == 0 && exponent >= 0 && exponent < Scalar(1u << 31) && Scalar(std::uint32_t(exponent)) == exponent) {
+			Taylor<Scalar, order> w = Taylor<Scalar, order>::constant(1);
+			Taylor<Scalar, order> square = u;
+			for (std::uint32_t n = std::uint32_t(exponent); n > 0; n >>= 1) {
+				if (n & 1) w = w * square;
+				if (n > 1) square = square * square;
+			}
+			return w;
+		}
+
+		Taylor<Scalar, order> w;
+		w.coefficients[0] = elementary::pow(u.coefficients[0], exponent);
+		for (std::size_t k = 1; k <= order; ++k) {
+			Scalar sum = 0;
+			for (std::size_t j = 1; j <= k; ++j) sum += (exponent * Scalar(j) - Scalar(k - j)) * u.coefficients[j] * w.coefficients[k - j];
+			w.coefficients[k] = sum / (Scalar(k) * u.coefficients[0]);
+		}
+		return w;
+	}
+
+	// Scalar is the precision constants are stored and expressions are evaluated in
+	template <typename Scalar, ExprType exprType, typename... Ts> struct Expression;
+
+	// expr while its type has at most AUTODIFF_ERASURE_NODES nodes, otherwise the same function as an Erased node -
+	// applied to every derivative, so repeated dx() cannot grow types without bound
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto capped(const Expression<Scalar, exprType, Ts...>& expr);
+
+	// Constant
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Constant, Zero> {
+		constexpr Scalar operator()(Scalar x) const { return 0; }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return 0.0f; }
+		constexpr auto dx() const { return Expression<Scalar, ExprType::Constant, Zero>{}; }
+		constexpr Dual<Scalar> evalDual(Scalar x) const { return {0, 0}; }
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return {}; }
+		static constexpr Scalar value = 0;
+	};
+	template <typename Scalar>
+	using BasicZeroExpr = Expression<Scalar, ExprType::Constant, Zero>;
+	using ZeroExpr = BasicZeroExpr<float>;
+
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Constant, One> {
+		constexpr Scalar operator()(Scalar x) const { return 1; }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return 1.0f; }
+		constexpr auto dx() const { return Expression<Scalar, ExprType::Constant, Zero>{}; }
+		constexpr Dual<Scalar> evalDual(Scalar x) const { return {1, 0}; }
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return Taylor<Scalar, order>::constant(1); }
+		static constexpr Scalar value = 1;
+	};
+	template <typename Scalar>
+	using BasicOneExpr = Expression<Scalar, ExprType::Constant, One>;
+	using OneExpr = BasicOneExpr<float>;
+
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Constant> {
+		constexpr Scalar operator()(Scalar x) const { return value; }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return value; }
+		constexpr auto dx() const { return Expression<Scalar, ExprType::Constant, Zero>{}; }
+		constexpr Dual<Scalar> evalDual(Scalar x) const { return {value, 0}; }
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return Taylor<Scalar, order>::constant(value); }
+		Scalar value;
 	};
 
-	using Constant = Expression<ExprType::Constant>;
+	template <typename Scalar>
+	using BasicConstant = Expression<Scalar, ExprType::Constant>;
+	using Constant = BasicConstant<float>;
 
 	// Variable
-	template <>
-	struct Expression<ExprType::Variable> {
-		constexpr float operator()(float x) { return x; }
-		constexpr auto dx() { return Expression<ExprType::Constant, One>{}; }
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Variable> {
+		constexpr Scalar operator()(Scalar x) const { return x; }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return x; }
+		constexpr auto dx() const { return Expression<Scalar, ExprType::Constant, One>{}; }
+		constexpr Dual<Scalar> evalDual(Scalar x) const { return {x, 1}; }
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return Taylor<Scalar, order>::variable(x); }
 	};
 
-	using Variable = Expression<ExprType::Variable>;
+	template <typename Scalar>
+	using BasicVariable = Expression<Scalar, ExprType::Variable>;
+	using Variable = BasicVariable<float>;
 
 	// Sum
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	struct Expression<ExprType::Sum, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>> {
-
-		constexpr float operator()(float x) { return lhs(x) + rhs(x); }
-		constexpr auto dx() { return lhs.dx() + rhs.dx(); }
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	struct Expression<Scalar, ExprType::Sum, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>> {
+
+		static constexpr auto apply(const auto& l, const auto& r) { return l + r; }
+
+		constexpr Scalar operator()(Scalar x) const { return lhs(x) + rhs(x); }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return lhs(x) + rhs(x); }
+		constexpr auto dx() const { return capped(lhs.dx() + rhs.dx()); }
+		constexpr Dual<Scalar> evalDual(Scalar x) const {
+			Dual<Scalar> l = lhs.evalDual(x);
+			Dual<Scalar> r = rhs.evalDual(x);
+			return {l.value + r.value, l.derivative + r.derivative};
+		}
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return apply(lhs.template evalTaylor<order>(x), rhs.template evalTaylor<order>(x)); }
 
-		Expression<exprType1, Ts1...> lhs;
-		Expression<exprType2, Ts2...> rhs;
+		Expression<Scalar, exprType1, Ts1...> lhs;
+		Expression<Scalar, exprType2, Ts2...> rhs;
 	};
 
 	// sum of expressions
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	constexpr auto operator+(const Expression<exprType1, Ts1...>& lhs,
-							 const Expression<exprType2, Ts2...>& rhs) {
-		using TypeLHS = Expression<exprType1, Ts1...>;
-		using TypeRHS = Expression<exprType2, Ts2...>;
-
-		if constexpr (std::is_same_v<TypeLHS, ZeroExpr>) return rhs;
-		else if constexpr (std::is_same_v<TypeRHS, ZeroExpr>) return lhs;
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	constexpr auto operator+(const Expression<Scalar, exprType1, Ts1...>& lhs,
+							 const Expression<Scalar, exprType2, Ts2...>& rhs) {
+		using TypeLHS = Expression<Scalar, exprType1, Ts1...>;
+		using TypeRHS = Expression<Scalar, exprType2, Ts2...>;
+
+		if constexpr (std::is_same_v<TypeLHS, BasicZeroExpr<Scalar>>) return rhs;
+		else if constexpr (std::is_same_v<TypeRHS, BasicZeroExpr<Scalar>>) return lhs;
 		else if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
-			return Constant{lhs.value + rhs.value};
+			return BasicConstant<Scalar>{lhs.value + rhs.value};
 		}
 		else {
-			return Expression<ExprType::Sum, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>>{lhs, rhs};
+			return Expression<Scalar, ExprType::Sum, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>>{lhs, rhs};
 		}
 	}
 
 	// Difference
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	struct Expression<ExprType::Difference, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>> {
-
-		constexpr float operator()(float x) { return lhs(x) - rhs(x); }
-		constexpr auto dx() { return lhs.dx() - rhs.dx(); }
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	struct Expression<Scalar, ExprType::Difference, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>> {
+
+		static constexpr auto apply(const auto& l, const auto& r) { return l - r; }
+
+		constexpr Scalar operator()(Scalar x) const { return lhs(x) - rhs(x); }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return lhs(x) - rhs(x); }
+		constexpr auto dx() const { return capped(lhs.dx() - rhs.dx()); }
+		constexpr Dual<Scalar> evalDual(Scalar x) const {
+			Dual<Scalar> l = lhs.evalDual(x);
+			Dual<Scalar> r = rhs.evalDual(x);
+			return {l.value - r.value, l.derivative - r.derivative};
+		}
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return apply(lhs.template evalTaylor<order>(x), rhs.template evalTaylor<order>(x)); }
 
-		Expression<exprType1, Ts1...> lhs;
-		Expression<exprType2, Ts2...> rhs;
+		Expression<Scalar, exprType1, Ts1...> lhs;
+		Expression<Scalar, exprType2, Ts2...> rhs;
 	};
 
 	// difference of expressions
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	auto operator-(const Expression<exprType1, Ts1...>& lhs,
-				   const Expression<exprType2, Ts2...>& rhs) {
-		using TypeLHS = Expression<exprType1, Ts1...>;
-		using TypeRHS = Expression<exprType2, Ts2...>;
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	auto operator-(const Expression<Scalar, exprType1, Ts1...>& lhs,
+				   const Expression<Scalar, exprType2, Ts2...>& rhs) {
+		using TypeLHS = Expression<Scalar, exprType1, Ts1...>;
+		using TypeRHS = Expression<Scalar, exprType2, Ts2...>;
 
-		if constexpr (std::is_same_v<TypeRHS, ZeroExpr>) return lhs;
+		if constexpr (std::is_same_v<TypeRHS, BasicZeroExpr<Scalar>>) return lhs;
 		else if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
-			return Expression<ExprType::Constant>{lhs.value - rhs.value};
+			return Expression<Scalar, ExprType::Constant>{lhs.value - rhs.value};
 		}
 		else {
-			return Expression<ExprType::Difference, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>>{lhs, rhs};
+			return Expression<Scalar, ExprType::Difference, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>>{lhs, rhs};
 		}
 	}
 
 	// Product
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	struct Expression<ExprType::Product, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>> {
-
-		constexpr float operator()(float x) { return lhs(x) * rhs(x); }
-		constexpr auto dx() { return lhs.dx() * rhs + lhs * rhs.dx(); }
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	struct Expression<Scalar, ExprType::Product, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>> {
+
+		static constexpr auto apply(const auto& l, const auto& r) { return l * r; }
+
+		constexpr Scalar operator()(Scalar x) const { return lhs(x) * rhs(x); }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return lhs(x) * rhs(x); }
+		constexpr auto dx() const { return capped(lhs.dx() * rhs + lhs * rhs.dx()); }
+		constexpr Dual<Scalar> evalDual(Scalar x) const {
+			Dual<Scalar> l = lhs.evalDual(x);
+			Dual<Scalar> r = rhs.evalDual(x);
+			return {l.value * r.value, l.derivative * r.value + l.value * r.derivative};
+		}
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return apply(lhs.template evalTaylor<order>(x), rhs.template evalTaylor<order>(x)); }
 
-		Expression<exprType1, Ts1...> lhs;
-		Expression<exprType2, Ts2...> rhs;
+		Expression<Scalar, exprType1, Ts1...> lhs;
+		Expression<Scalar, exprType2, Ts2...> rhs;
 	};
 
 	// product of expressions
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	auto operator*(const Expression<exprType1, Ts1...>& lhs,
-				   const Expression<exprType2, Ts2...>& rhs) {
-		using TypeLHS = Expression<exprType1, Ts1...>;
-		using TypeRHS = Expression<exprType2, Ts2...>;
-
-		if constexpr (std::is_same_v<TypeLHS, ZeroExpr> || std::is_same_v<TypeRHS, ZeroExpr>) return ZeroExpr{};
-		else if constexpr (std::is_same_v<TypeLHS, OneExpr>) return rhs;
-		else if constexpr (std::is_same_v<TypeRHS, OneExpr>) return lhs;
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	auto operator*(const Expression<Scalar, exprType1, Ts1...>& lhs,
+				   const Expression<Scalar, exprType2, Ts2...>& rhs) {
+		using TypeLHS = Expression<Scalar, exprType1, Ts1...>;
+		using TypeRHS = Expression<Scalar, exprType2, Ts2...>;
+
+		if constexpr (std::is_same_v<TypeLHS, BasicZeroExpr<Scalar>> || std::is_same_v<TypeRHS, BasicZeroExpr<Scalar>>) return BasicZeroExpr<Scalar>{};
+		else if constexpr (std::is_same_v<TypeLHS, BasicOneExpr<Scalar>>) return rhs;
+		else if constexpr (std::is_same_v<TypeRHS, BasicOneExpr<Scalar>>) return lhs;
 		else if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
-			return Expression<ExprType::Constant>{lhs.value* rhs.value};
+			return Expression<Scalar, ExprType::Constant>{lhs.value* rhs.value};
 		}
 		else {
-			return Expression<ExprType::Product, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>>{lhs, rhs};
+			return Expression<Scalar, ExprType::Product, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>>{lhs, rhs};
 		}
 	}
 
 	// Quotient
-	template <ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
-	struct Expression<ExprType::Quotient, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>> {
-
-		constexpr float operator()(float x) { return lhs(x) / rhs(x); }
-		constexpr auto dx() { return (lhs.dx() * rhs - lhs * rhs.dx()) / (rhs * rhs); }
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	struct Expression<Scalar, ExprType::Quotient, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>> {
+
+		static constexpr auto apply(const auto& l, const auto& r) { return l / r; }
+
+		constexpr Scalar operator()(Scalar x) const { return lhs(x) / rhs(x); }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return lhs(x) / rhs(x); }
+		constexpr auto dx() const { return capped((lhs.dx() * rhs - lhs * rhs.dx()) / (rhs * rhs)); }
+		constexpr Dual<Scalar> evalDual(Scalar x) const {
+			Dual<Scalar> l = lhs.evalDual(x);
+			Dual<Scalar> r = rhs.evalDual(x);
+			Scalar value = l.value / r.value;
+			return {value, (l.derivative - value * r.derivative) / r.value};
+		}
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return apply(lhs.template evalTaylor<order>(x), rhs.template evalTaylor<order>(x)); }
 
-		Expression<exprType1, Ts1...> lhs;
-		Expression<exprType2, Ts2...> rhs;
+		Expression<Scalar, exprType1, Ts1...> lhs;
+		Expression<Scalar, exprType2, Ts2...> rhs;
 	};
 
 	// quotient of expressions
-	template <ExprType exprType1, typename... Ts1,
+	template <typename Scalar, ExprType exprType1, typename... Ts1,
 		ExprType exprType2, typename... Ts2>
-	auto operator/(const Expression<exprType1, Ts1...>& lhs,
-				   const Expression<exprType2, Ts2...>& rhs) {
-		using TypeLHS = Expression<exprType1, Ts1...>;
-		using TypeRHS = Expression<exprType2, Ts2...>;
-
-		if constexpr (std::is_same_v<TypeRHS, ZeroExpr>) return ZeroExpr{};	// todo: fix this
-		else if constexpr (std::is_same_v<TypeLHS, ZeroExpr>) return ZeroExpr{};
-		else if constexpr (std::is_same_v<TypeRHS, OneExpr>) return lhs;
+	auto operator/(const Expression<Scalar, exprType1, Ts1...>& lhs,
+				   const Expression<Scalar, exprType2, Ts2...>& rhs) {
+		using TypeLHS = Expression<Scalar, exprType1, Ts1...>;
+		using TypeRHS = Expression<Scalar, exprType2, Ts2...>;
+
+		if constexpr (std::is_same_v<TypeRHS, BasicZeroExpr<Scalar>>) return BasicZeroExpr<Scalar>{};	// todo: fix this
+		else if constexpr (std::is_same_v<TypeLHS, BasicZeroExpr<Scalar>>) return BasicZeroExpr<Scalar>{};
+		else if constexpr (std::is_same_v<TypeRHS, BasicOneExpr<Scalar>>) return lhs;
 		else if constexpr (exprType1 == ExprType::Constant && exprType2 == ExprType::Constant) {
-			return Expression<ExprType::Constant>{lhs.value / rhs.value};
+			return Expression<Scalar, ExprType::Constant>{lhs.value / rhs.value};
 		}
 		else {
-			return Expression<ExprType::Quotient, Expression<exprType1, Ts1...>, Expression<exprType2, Ts2...>>{lhs, rhs};
+			return Expression<Scalar, ExprType::Quotient, Expression<Scalar, exprType1, Ts1...>, Expression<Scalar, exprType2, Ts2...>>{lhs, rhs};
 		}
 	}
 
-	// global operators with floats
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator+(const Expression<exprType, Ts...>& lhs, float rhs) { return lhs + Constant{rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator+(float lhs, const Expression<exprType, Ts...>& rhs) { return Constant{lhs} + rhs; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator-(const Expression<exprType, Ts...>& lhs, float rhs) { return lhs + Constant{-rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator-(float lhs, const Expression<exprType, Ts...>& rhs) { return Constant{lhs} - rhs; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator*(const Expression<exprType, Ts...>& lhs, float rhs) { return lhs * Constant{rhs}; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator*(float lhs, const Expression<exprType, Ts...>& rhs) { return Constant{lhs} *rhs; }
-	template <ExprType exprType, typename... Ts>
-	constexpr auto operator/(const Expression<exprType, Ts...>& lhs, float rhs) { return lhs / Constant{rhs}; }
+	// global operators with scalars - the scalar converts to the expression's precision
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator+(const Expression<Scalar, exprType, Ts...>& lhs, std::type_identity_t<Scalar> rhs) { return lhs + BasicConstant<Scalar>{rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator+(std::type_identity_t<Scalar> lhs, const Expression<Scalar, exprType, Ts...>& rhs) { return BasicConstant<Scalar>{lhs} + rhs; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator-(const Expression<Scalar, exprType, Ts...>& lhs, std::type_identity_t<Scalar> rhs) { return lhs + BasicConstant<Scalar>{-rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator-(std::type_identity_t<Scalar> lhs, const Expression<Scalar, exprType, Ts...>& rhs) { return BasicConstant<Scalar>{lhs} - rhs; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator*(const Expression<Scalar, exprType, Ts...>& lhs, std::type_identity_t<Scalar> rhs) { return lhs * BasicConstant<Scalar>{rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator*(std::type_identity_t<Scalar> lhs, const Expression<Scalar, exprType, Ts...>& rhs) { return BasicConstant<Scalar>{lhs} *rhs; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator/(const Expression<Scalar, exprType, Ts...>& lhs, std::type_identity_t<Scalar> rhs) { return lhs / BasicConstant<Scalar>{rhs}; }
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto operator/(std::type_identity_t<Scalar> lhs, const Expression<Scalar, exprType, Ts...>& rhs) { return BasicConstant<Scalar>{lhs} / rhs; }
+
+	// Elementary function of an expression - exp, log, sin, cos, sqrt
+	template <typename Scalar, ExprType exprType, ExprType exprType1, typename... Ts1>
+		requires (isElementary(exprType))
+	struct Expression<Scalar, exprType, Expression<Scalar, exprType1, Ts1...>> {
+		static constexpr elementary::Function function = functionOf(exprType);
+
+		static constexpr auto apply(const auto& u) { return elementary::value<function>(u); }
+
+		constexpr Scalar operator()(Scalar x) const { return apply(operand(x)); }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return apply(operand(x)); }
+		constexpr auto dx() const { return capped(slope() * operand.dx()); }
+		constexpr Dual<Scalar> evalDual(Scalar x) const {
+			Dual<Scalar> u = operand.evalDual(x);
+			elementary::ValueSlope<Scalar> f = elementary::valueSlope<function>(u.value);
+			return {f.value, f.slope * u.derivative};
+		}
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return apply(operand.template evalTaylor<order>(x)); }
+
+		// derivative with respect to the operand, as an expression
+		constexpr auto slope() const {
+			if constexpr (exprType == ExprType::Exp) return *this;
+			else if constexpr (exprType == ExprType::Log) return BasicOneExpr<Scalar>{} / operand;
+			else if constexpr (exprType == ExprType::Sin) return cos(operand);
+			else if constexpr (exprType == ExprType::Cos) return Scalar(-1) * sin(operand);
+			else return Scalar(0.5) / *this;
+		}
+
+		Expression<Scalar, exprType1, Ts1...> operand;
+	};
+
+	// Power with a constant exponent
+	template <typename Scalar, ExprType exprType1, typename... Ts1>
+	struct Expression<Scalar, ExprType::Pow, Expression<Scalar, exprType1, Ts1...>> {
+
+		constexpr auto apply(const auto& u) const { return elementary::pow(u, exponent); }
+
+		constexpr Scalar operator()(Scalar x) const { return apply(operand(x)); }
+		simd::FloatPack operator()(const simd::FloatPack& x) const { return apply(operand(x)); }
+		constexpr auto dx() const { return capped(slope() * operand.dx()); }
+		constexpr Dual<Scalar> evalDual(Scalar x) const {
+			Dual<Scalar> u = operand.evalDual(x);
+			elementary::ValueSlope<Scalar> f = elementary::powValueSlope(u.value, exponent);
+			return {f.value, f.slope * u.derivative};
+		}
+		template <std::size_t order>
+		constexpr Taylor<Scalar, order> evalTaylor(Scalar x) const { return pow(operand.template evalTaylor<order>(x), exponent); }
+
+		// derivative with respect to the operand, as an expression
+		constexpr auto slope() const { return exponent * pow(operand, exponent - 1); }
+
+		Expression<Scalar, exprType1, Ts1...> operand;
+		Scalar exponent;
+	};
+
+	// Expression whose structure lives in a shared, hash-consed graph instead of its type - every distinct
+	// subexpression is one node, so the repeated subtrees of high-order derivatives cost nothing to compile and
+	// are evaluated once. Calls walk the graph, with node values in a per-thread buffer
+	template <typename Scalar>
+	struct Expression<Scalar, ExprType::Erased> {
+		Scalar operator()(Scalar x) const {
+			std::span<Scalar> values = scratch(graph->size());
+			graph->evaluate(std::span<const Scalar>{&x, 1}, values);
+			return values[root];
+		}
+		simd::FloatPack operator()(const simd::FloatPack& x) const {
+			std::span<simd::FloatPack> values = scratch<simd::FloatPack>(root + 1);
+			walk(values, x);
+			return values[root];
+		}
+		auto dx() const {
+			graph::Graph<Scalar> derivative = graph::gradientGraph(*graph, root);
+			return erasedOf(derivative, derivative.outputs()[1]);
+		}
+		Dual<Scalar> evalDual(Scalar x) const {
+			Scalar direction = 1;
+			std::span<Scalar> buffer = scratch(2 * graph->size());
+			std::span<Scalar> values = buffer.first(graph->size());
+			std::span<Scalar> tangents = buffer.last(graph->size());
+			graph->derivative(std::span<const Scalar>{&x, 1}, std::span<const Scalar>{&direction, 1}, values, tangents);
+			return {values[root], tangents[root]};
+		}
+		template <std::size_t order>
+		Taylor<Scalar, order> evalTaylor(Scalar x) const {
+			std::span<Taylor<Scalar, order>> series = scratch<Taylor<Scalar, order>>(root + 1);
+			walk(series, Taylor<Scalar, order>::variable(x));
+			return series[root];
+		}
+
+		// value of every node up to root in any number type with the arithmetic and elementary functions of the
+		// graph ops, the variable reading x
+		template <typename T>
+		void walk(std::span<T> values, const T& x) const {
+			using graph::Op;
+			std::span<const graph::Node<Scalar>> nodes = graph->nodes();
+			for (std::size_t i = 0; i <= root; ++i) {
+				const graph::Node<Scalar>& node = nodes[i];
+				switch (node.op) {
+				case Op::Constant:
+					if constexpr (requires { T::constant(node.payload); }) values[i] = T::constant(node.payload);
+					else values[i] = T(node.payload);
+					break;
+				case Op::Variable: values[i] = x; break;
+				case Op::Sum: values[i] = values[node.lhs] + values[node.rhs]; break;
+				case Op::Difference: values[i] = values[node.lhs] - values[node.rhs]; break;
+				case Op::Product: values[i] = values[node.lhs] * values[node.rhs]; break;
+				case Op::Quotient: values[i] = values[node.lhs] / values[node.rhs]; break;
+				case Op::Exp: values[i] = exp(values[node.lhs]); break;
+				case Op::Log: values[i] = log(values[node.lhs]); break;
+				case Op::Sin: values[i] = sin(values[node.lhs]); break;
+				case Op::Cos: values[i] = cos(values[node.lhs]); break;
+				case Op::Sqrt: values[i] = sqrt(values[node.lhs]); break;
+				case Op::Pow: values[i] = pow(values[node.lhs], node.payload); break;
+				}
+			}
+		}
+
+		// the nodes root depends on, copied out of source into a graph of their own
+		static Expression erasedOf(const graph::Graph<Scalar>& source, graph::NodeId root) {
+			auto compact = std::make_shared<graph::Graph<Scalar>>();
+			// the variable always has a slot, so every derivative graph has a d/dx output
+			graph::NodeId x = compact->variable(0);
+			graph::NodeId copy = compact->append(source, root, std::span<const graph::NodeId>{&x, 1});
+			return {compact, copy};
+		}
+
+		// per-thread buffer, valid until the next call on this thread with the same T
+		template <typename T = Scalar>
+		static std::span<T> scratch(std::size_t size) {
+			thread_local std::vector<T> buffer;
+			if (buffer.size() < size) buffer.resize(size);
+			return {buffer.data(), size};
+		}
+
+		std::shared_ptr<const graph::Graph<Scalar>> graph;
+		graph::NodeId root;
+	};
+
+	template <typename Scalar>
+	using BasicErased = Expression<Scalar, ExprType::Erased>;
+
+	// elementary function of an expression - constant operands are evaluated right away
+	template <ExprType function, typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto elementaryOf(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (exprType == ExprType::Constant) return BasicConstant<Scalar>{elementary::value<functionOf(function)>(Scalar(operand.value))};
+		else return Expression<Scalar, function, Expression<Scalar, exprType, Ts...>>{operand};
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto exp(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicZeroExpr<Scalar>>) return BasicOneExpr<Scalar>{};
+		else return elementaryOf<ExprType::Exp>(operand);
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto log(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicOneExpr<Scalar>>) return BasicZeroExpr<Scalar>{};
+		else return elementaryOf<ExprType::Log>(operand);
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto sin(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicZeroExpr<Scalar>>) return BasicZeroExpr<Scalar>{};
+		else return elementaryOf<ExprType::Sin>(operand);
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto cos(const Expression<Scalar, exprType, Ts...>& operand) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicZeroExpr<Scalar>>) return BasicOneExpr<Scalar>{};
+		else return elementaryOf<ExprType::Cos>(operand);
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto sqrt(const Expression<Scalar, exprType, Ts...>& operand) {
+		using Type = Expression<Scalar, exprType, Ts...>;
+
+		if constexpr (std::is_same_v<Type, BasicZeroExpr<Scalar>> || std::is_same_v<Type, BasicOneExpr<Scalar>>) return operand;
+		else return elementaryOf<ExprType::Sqrt>(operand);
+	}
+
+	// expression raised to a constant power
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto pow(const Expression<Scalar, exprType, Ts...>& base, std::type_identity_t<Scalar> exponent) {
+		if constexpr (std::is_same_v<Expression<Scalar, exprType, Ts...>, BasicOneExpr<Scalar>>) return base;
+		else if constexpr (exprType == ExprType::Constant) return BasicConstant<Scalar>{elementary::pow(Scalar(base.value), exponent)};
+		else return Expression<Scalar, ExprType::Pow, Expression<Scalar, exprType, Ts...>>{base, exponent};
+	}
+
+	// expression raised to an expression power, as exp(exponent * log(base)) - defined for positive bases
+	template <typename Scalar, ExprType exprType1, typename... Ts1, ExprType exprType2, typename... Ts2>
+	constexpr auto pow(const Expression<Scalar, exprType1, Ts1...>& base, const Expression<Scalar, exprType2, Ts2...>& exponent) {
+		if constexpr (exprType2 == ExprType::Constant) return pow(base, Scalar(exponent.value));
+		else return exp(exponent * log(base));
+	}
+
+	// f(x), f'(x), ..., the order-th derivative of f at x from a single Taylor pass - e.g. for Halley or
+	// Householder steps, or the terms of a Taylor-series integrator
+	template <std::size_t order, typename Scalar, ExprType exprType, typename... Ts>
+	constexpr std::array<Scalar, order + 1> derivatives(const Expression<Scalar, exprType, Ts...>& expr, std::type_identity_t<Scalar> x) {
+		Taylor<Scalar, order> series = expr.template evalTaylor<order>(x);
+		std::array<Scalar, order + 1> result{};
+		for (std::size_t k = 0; k <= order; ++k) result[k] = series.derivative(k);
+		return result;
+	}
+
+	// evaluates expr at every point of xs into out, one vector of lanes per tree walk with a scalar tail
 	template <ExprType exprType, typename... Ts>
-	constexpr auto operator/(float lhs, const Expression<exprType, Ts...>& rhs) { return Constant{lhs} / rhs; }
+	void evaluateBatch(const Expression<float, exprType, Ts...>& expr, std::span<const float> xs, std::span<float> out) {
+		std::size_t i = 0;
+		for (; i + simd::FloatPack::width <= xs.size(); i += simd::FloatPack::width) {
+			expr(simd::FloatPack::load(xs.data() + i)).store(out.data() + i);
+		}
+		for (; i < xs.size(); ++i) {
+			out[i] = expr(xs[i]);
+		}
+	}
+
+	// adds the nodes of expr to graph and returns its root - the variable reads inputs[0]
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	graph::NodeId appendTo(graph::Graph<Scalar>& graph, const Expression<Scalar, exprType, Ts...>& expr) {
+		if constexpr (exprType == ExprType::Constant) return graph.constant(Scalar(expr.value));
+		else if constexpr (exprType == ExprType::Variable) return graph.variable(0);
+		else if constexpr (exprType == ExprType::Erased) {
+			graph::NodeId x = graph.variable(0);
+			return graph.append(*expr.graph, expr.root, std::span<const graph::NodeId>{&x, 1});
+		}
+		else if constexpr (exprType == ExprType::Pow) return graph.pow(appendTo(graph, expr.operand), expr.exponent);
+		else if constexpr (requires { expr.operand; }) return graph.add(graph::opOf(exprType), appendTo(graph, expr.operand));
+		else {
+			graph::NodeId lhs = appendTo(graph, expr.lhs);
+			graph::NodeId rhs = appendTo(graph, expr.rhs);
+			return graph.add(graph::opOf(exprType), lhs, rhs);
+		}
+	}
+
+	template <typename Scalar, ExprType exprType, typename... Ts>
+	constexpr auto capped(const Expression<Scalar, exprType, Ts...>& expr) {
+		if constexpr (cse::nodeCount<Expression<Scalar, exprType, Ts...>> <= AUTODIFF_ERASURE_NODES) return expr;
+		else {
+			graph::Graph<Scalar> lowered;
+			return BasicErased<Scalar>::erasedOf(lowered, appendTo(lowered, expr));
+		}
+	}
 
 
 
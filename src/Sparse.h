@@ -0,0 +1,415 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <span>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "Graph.h"
+#include "Lowering.h"
+#include "MultiVarDiff.h"
+
+// sparse Jacobians and Hessians - the sparsity pattern is found once on the lowered graph, and a coloring of
+// the variables lets one sweep recover every column (or Hessian entry) of a color together, so the cost grows
+// with the number of colors instead of the number of variables
+namespace sparse {
+
+	using multiVarDiff::Layout;
+
+	// Sparsity pattern in compressed row form - the nonzeros of row i sit in columns
+	// indices[offsets[i]] ... indices[offsets[i + 1] - 1], in increasing order
+	struct Pattern {
+		std::size_t rows = 0;
+		std::size_t columns = 0;
+		std::vector<std::size_t> offsets{0};
+		std::vector<std::size_t> indices;
+
+		std::size_t nonzeros() const { return indices.size(); }
+		std::span<const std::size_t> row(std::size_t i) const { return std::span<const std::size_t>{indices}.subspan(offsets[i], offsets[i + 1] - offsets[i]); }
+	};
+
+	// Sparse matrix in compressed rows (CSR, Layout::RowMajor) or compressed columns (CSC, Layout::ColumnMajor).
+	// Line i is a row or column by layout; its entries are values[offsets[i]] ... values[offsets[i + 1] - 1], at the
+	// columns or rows indices[k]
+	template <typename Scalar>
+	struct Matrix {
+		Layout layout = Layout::RowMajor;
+		std::size_t rows = 0;
+		std::size_t columns = 0;
+		std::vector<std::size_t> offsets;
+		std::vector<std::size_t> indices;
+		std::vector<Scalar> values;
+	};
+
+	namespace detail {
+
+		// sorted union of two sorted index lists
+		inline std::vector<std::uint32_t> merged(const std::vector<std::uint32_t>& a, const std::vector<std::uint32_t>& b) {
+			std::vector<std::uint32_t> out;
+			out.reserve(a.size() + b.size());
+			std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(out));
+			return out;
+		}
+
+		// input slots every node depends on, propagated forward through the node array
+		template <typename Scalar>
+		std::vector<std::vector<std::uint32_t>> dependencies(const graph::Graph<Scalar>& graph) {
+			using graph::Op;
+			std::span<const graph::Node<Scalar>> nodes = graph.nodes();
+			std::vector<std::vector<std::uint32_t>> deps(nodes.size());
+			for (std::size_t i = 0; i < nodes.size(); ++i) {
+				const graph::Node<Scalar>& node = nodes[i];
+				if (node.op == Op::Variable) deps[i] = {node.lhs};
+				else if (graph::isBinary(node.op)) deps[i] = merged(deps[node.lhs], deps[node.rhs]);
+				else if (graph::isUnary(node.op)) deps[i] = deps[node.lhs];
+			}
+			return deps;
+		}
+
+		inline Pattern compressed(std::vector<std::vector<std::uint32_t>> lines, std::size_t columns) {
+			Pattern pattern;
+			pattern.rows = lines.size();
+			pattern.columns = columns;
+			for (std::vector<std::uint32_t>& line : lines) {
+				std::ranges::sort(line);
+				line.erase(std::unique(line.begin(), line.end()), line.end());
+				pattern.indices.insert(pattern.indices.end(), line.begin(), line.end());
+				pattern.offsets.push_back(pattern.indices.size());
+			}
+			return pattern;
+		}
+
+		// pattern with rows and columns exchanged
+		inline Pattern transposed(const Pattern& pattern) {
+			std::vector<std::vector<std::uint32_t>> lines(pattern.columns);
+			for (std::size_t i = 0; i < pattern.rows; ++i) {
+				for (std::size_t j : pattern.row(i)) lines[j].push_back(static_cast<std::uint32_t>(i));
+			}
+			return compressed(std::move(lines), pattern.rows);
+		}
+
+		// smallest color not marked with stamp
+		inline std::size_t firstFree(std::vector<std::size_t>& forbidden, std::size_t stamp) {
+			std::size_t color = 0;
+			while (color < forbidden.size() && forbidden[color] == stamp) ++color;
+			if (color == forbidden.size()) forbidden.push_back(std::numeric_limits<std::size_t>::max());
+			return color;
+		}
+
+	}
+
+	// rows[i] = the input slots roots[i] depends on - a structural pattern, so entries that vanish only at some
+	// points are kept
+	template <typename Scalar>
+	Pattern jacobianPattern(const graph::Graph<Scalar>& graph, std::span<const graph::NodeId> roots, std::size_t columns) {
+		std::vector<std::vector<std::uint32_t>> deps = detail::dependencies(graph);
+		std::vector<std::vector<std::uint32_t>> lines;
+		for (graph::NodeId root : roots) lines.push_back(deps[root]);
+		return detail::compressed(std::move(lines), columns);
+	}
+
+	// Pattern of the Hessian of root. Products and quotients couple the inputs of their operands, and nonlinear
+	// functions all inputs of their operand with each other; sums and differences couple nothing
+	template <typename Scalar>
+	Pattern hessianPattern(const graph::Graph<Scalar>& graph, graph::NodeId root, std::size_t columns) {
+		using graph::Op;
+		std::span<const graph::Node<Scalar>> nodes = graph.nodes();
+		std::vector<std::vector<std::uint32_t>> deps = detail::dependencies(graph);
+
+		std::vector<bool> live(root + 1);
+		live[root] = true;
+		for (std::size_t i = root + 1; i-- > 0;) {
+			if (!live[i]) continue;
+			if (graph::isBinary(nodes[i].op) || graph::isUnary(nodes[i].op)) live[nodes[i].lhs] = true;
+			if (graph::isBinary(nodes[i].op)) live[nodes[i].rhs] = true;
+		}
+
+		std::vector<std::vector<std::uint32_t>> lines(columns);
+		auto couple = [&](const std::vector<std::uint32_t>& a, const std::vector<std::uint32_t>& b) {
+			for (std::uint32_t i : a) {
+				for (std::uint32_t j : b) {
+					lines[i].push_back(j);
+					lines[j].push_back(i);
+				}
+			}
+		};
+		for (std::size_t i = 0; i <= root; ++i) {
+			if (!live[i]) continue;
+			const graph::Node<Scalar>& node = nodes[i];
+			switch (node.op) {
+			case Op::Constant:
+			case Op::Variable:
+			case Op::Sum:
+			case Op::Difference: break;
+			case Op::Product: couple(deps[node.lhs], deps[node.rhs]); break;
+			case Op::Quotient:
+				couple(deps[node.lhs], deps[node.rhs]);
+				couple(deps[node.rhs], deps[node.rhs]);
+				break;
+			case Op::Pow:
+				if (node.payload != Scalar(0) && node.payload != Scalar(1)) couple(deps[node.lhs], deps[node.lhs]);
+				break;
+			default: couple(deps[node.lhs], deps[node.lhs]); break;
+			}
+		}
+		return detail::compressed(std::move(lines), columns);
+	}
+
+	// Greedy distance-2 coloring of the columns of a Jacobian pattern - columns that share a row get different
+	// colors, so the columns of one color can be seeded together and told apart by their rows
+	inline std::vector<std::size_t> columnColoring(const Pattern& pattern) {
+		Pattern columns = detail::transposed(pattern);
+		std::vector<std::size_t> colors(pattern.columns);
+		std::vector<std::size_t> forbidden;
+		for (std::size_t j = 0; j < pattern.columns; ++j) {
+			for (std::size_t row : columns.row(j)) {
+				for (std::size_t other : pattern.row(row)) {
+					if (other < j) forbidden[colors[other]] = j;
+				}
+			}
+			colors[j] = detail::firstFree(forbidden, j);
+		}
+		return colors;
+	}
+
+	// Greedy star coloring of the adjacency graph of a symmetric pattern: neighbors get different colors and every
+	// path on four vertices uses at least three, so each off-diagonal entry is the only term of its color in row i
+	// or in row j of a compressed Hessian. A vertex takes the smallest color that completes no two-colored path
+	inline std::vector<std::size_t> starColoring(const Pattern& pattern) {
+		constexpr std::size_t none = std::numeric_limits<std::size_t>::max();
+		const std::size_t n = pattern.rows;
+		std::vector<std::size_t> colors(n, none);
+		std::vector<std::size_t> forbidden;
+		std::vector<std::size_t> neighborColors;		// neighbors of v per color, valid where counted[c] == v
+		std::vector<std::size_t> counted;
+
+		auto neighbors = [&](std::size_t v) { return pattern.row(v); };
+		for (std::size_t v = 0; v < n; ++v) {
+			auto forbid = [&](std::size_t color) {
+				if (color >= forbidden.size()) forbidden.resize(color + 1, none);
+				forbidden[color] = v;
+			};
+			auto count = [&](std::size_t color) -> std::size_t& {
+				if (color >= counted.size()) {
+					counted.resize(color + 1, none);
+					neighborColors.resize(color + 1);
+				}
+				if (counted[color] != v) {
+					counted[color] = v;
+					neighborColors[color] = 0;
+				}
+				return neighborColors[color];
+			};
+
+			for (std::size_t w : neighbors(v)) {
+				if (w == v || colors[w] == none) continue;
+				forbid(colors[w]);
+				++count(colors[w]);
+			}
+			for (std::size_t w : neighbors(v)) {
+				if (w == v || colors[w] == none) continue;
+				// v at the end of v-w-x-y: v may not repeat x when y repeats w
+				for (std::size_t x : neighbors(w)) {
+					if (x == v || x == w || colors[x] == none) continue;
+					for (std::size_t y : neighbors(x)) {
+						if (y != w && y != x && colors[y] == colors[w]) {
+							forbid(colors[x]);
+							break;
+						}
+					}
+				}
+				// v inside a-v-w-y with a of the color of w: v may not repeat y
+				if (count(colors[w]) > 1) {
+					for (std::size_t y : neighbors(w)) {
+						if (y != v && y != w && colors[y] != none) forbid(colors[y]);
+					}
+				}
+			}
+			colors[v] = detail::firstFree(forbidden, v);
+		}
+		return colors;
+	}
+
+	inline std::size_t colorCount(std::span<const std::size_t> colors) {
+		return colors.empty() ? 0 : *std::ranges::max_element(colors) + 1;
+	}
+
+	// Jacobian of a system of expressions over IndexedVariables, with its pattern and column coloring worked out
+	// once. Evaluation seeds directions colors per forward sweep through vector forward mode, so each row costs
+	// ceil(colors / directions) passes however many variables there are
+	template <typename First, typename... Rest>
+	class SparseJacobian {
+	public:
+		using Scalar = multiVarDiff::ScalarOfT<First>;
+		static constexpr std::size_t rowCount = 1 + sizeof...(Rest);
+		static constexpr std::size_t columnCount = std::max({multiVarDiff::indexedSlots<First>, multiVarDiff::indexedSlots<Rest>...});
+
+		// throws std::invalid_argument when a row reads a variable bound by address
+		explicit SparseJacobian(const std::tuple<First, Rest...>& rows, Layout layout = Layout::RowMajor) : rows(rows), layout(layout) {
+			graph::Graph<Scalar> lowered;
+			std::array<graph::NodeId, rowCount> roots;
+			std::size_t row = 0;
+			std::apply([&](const auto&... exprs) {
+				((roots[row++] = graph::lower(lowered, exprs, std::array<const multiVarDiff::BasicVariable<Scalar>*, 0>{})), ...);
+			}, rows);
+			rowPattern = jacobianPattern(lowered, std::span<const graph::NodeId>{roots}, columnCount);
+			colors = columnColoring(rowPattern);
+
+			// position of each nonzero of rowPattern in the values of the result
+			slots.resize(rowPattern.nonzeros());
+			if (layout == Layout::RowMajor) {
+				for (std::size_t k = 0; k < slots.size(); ++k) slots[k] = k;
+			}
+			else {
+				Pattern columnPattern = detail::transposed(rowPattern);
+				std::vector<std::size_t> next(columnPattern.offsets.begin(), columnPattern.offsets.end() - 1);
+				for (std::size_t i = 0; i < rowCount; ++i) {
+					for (std::size_t k = rowPattern.offsets[i]; k < rowPattern.offsets[i + 1]; ++k) slots[k] = next[rowPattern.indices[k]]++;
+				}
+			}
+		}
+
+		const Pattern& pattern() const { return rowPattern; }
+		std::span<const std::size_t> columnColors() const { return colors; }
+		std::size_t colorCount() const { return sparse::colorCount(colors); }
+
+		// the structure of the result, with values zero
+		Matrix<Scalar> matrix() const {
+			Matrix<Scalar> out{layout, rowCount, columnCount};
+			Pattern structure = layout == Layout::RowMajor ? rowPattern : detail::transposed(rowPattern);
+			out.offsets = std::move(structure.offsets);
+			out.indices = std::move(structure.indices);
+			out.values.assign(out.indices.size(), Scalar(0));
+			return out;
+		}
+
+		// writes the nonzeros at values into out, which must have the structure of matrix(). Returns the value of
+		// every row
+		template <std::size_t directions = 8>
+		std::array<Scalar, rowCount> evaluate(std::span<const Scalar> values, Matrix<Scalar>& out) const {
+			using Dual = multiVarDiff::VectorDual<Scalar, directions>;
+			std::array<Dual, columnCount> seeded;
+			for (std::size_t column = 0; column < columnCount; ++column) seeded[column].value = values[column];
+
+			std::array<Scalar, rowCount> rowValues{};
+			for (std::size_t first = 0; first < std::max<std::size_t>(colorCount(), 1); first += directions) {
+				for (std::size_t column = 0; column < columnCount; ++column) {
+					seeded[column].derivatives.fill(Scalar(0));
+					if (colors[column] >= first && colors[column] < first + directions) seeded[column].derivatives[colors[column] - first] = 1;
+				}
+
+				std::size_t row = 0;
+				std::apply([&](const auto&... exprs) {
+					([&](const auto& expr) {
+						Dual result = expr(std::span<const Dual>{seeded});
+						rowValues[row] = result.value;
+						for (std::size_t k = rowPattern.offsets[row]; k < rowPattern.offsets[row + 1]; ++k) {
+							std::size_t color = colors[rowPattern.indices[k]];
+							if (color >= first && color < first + directions) out.values[slots[k]] = result.derivatives[color - first];
+						}
+						++row;
+					}(exprs), ...);
+				}, rows);
+			}
+			return rowValues;
+		}
+
+		Matrix<Scalar> operator()(std::span<const Scalar> values) const {
+			Matrix<Scalar> out = matrix();
+			evaluate(values, out);
+			return out;
+		}
+
+	private:
+		std::tuple<First, Rest...> rows;
+		Layout layout;
+		Pattern rowPattern;
+		std::vector<std::size_t> colors;
+		std::vector<std::size_t> slots;
+	};
+
+	// Hessian of an expression over IndexedVariables, with its pattern and star coloring worked out once. Every
+	// color costs one Hessian-vector product along the sum of its unit vectors, and each entry is read directly
+	// from one of them. The result holds both triangles in compressed rows, which for a symmetric matrix are
+	// also its compressed columns
+	template <typename Expr>
+	class SparseHessian {
+	public:
+		using Scalar = multiVarDiff::ScalarOfT<Expr>;
+		static constexpr std::size_t size = multiVarDiff::indexedSlots<Expr>;
+
+		// throws std::invalid_argument when expr reads a variable bound by address
+		explicit SparseHessian(const Expr& expr) : expr(expr) {
+			graph::Graph<Scalar> lowered;
+			graph::NodeId root = graph::lower(lowered, expr, std::array<const multiVarDiff::BasicVariable<Scalar>*, 0>{});
+			entries = hessianPattern(lowered, root, size);
+			colors = starColoring(entries);
+
+			// entry (i, j) is read from row i of the product of color(j) unless another neighbor of i shares that
+			// color - the star coloring then guarantees row j of the product of color(i) is clean
+			std::vector<std::size_t> stamp(sparse::colorCount(colors), std::numeric_limits<std::size_t>::max());
+			std::vector<std::size_t> repeated(stamp.size());
+			sources.resize(entries.nonzeros());
+			for (std::size_t i = 0; i < size; ++i) {
+				for (std::size_t j : entries.row(i)) {
+					if (j == i) continue;
+					if (stamp[colors[j]] != i) {
+						stamp[colors[j]] = i;
+						repeated[colors[j]] = 0;
+					}
+					++repeated[colors[j]];
+				}
+				for (std::size_t k = entries.offsets[i]; k < entries.offsets[i + 1]; ++k) {
+					std::size_t j = entries.indices[k];
+					sources[k] = j == i || repeated[colors[j]] == 1 ? Source{colors[j], i} : Source{colors[i], j};
+				}
+			}
+		}
+
+		const Pattern& pattern() const { return entries; }
+		std::span<const std::size_t> variableColors() const { return colors; }
+		std::size_t colorCount() const { return sparse::colorCount(colors); }
+
+		// the structure of the result, with values zero
+		Matrix<Scalar> matrix() const {
+			return {Layout::RowMajor, size, size, entries.offsets, entries.indices, std::vector<Scalar>(entries.nonzeros())};
+		}
+
+		// writes the nonzeros at values into out, which must have the structure of matrix(). Returns the value of expr
+		Scalar evaluate(std::span<const Scalar> values, Matrix<Scalar>& out) const {
+			const std::size_t colorTotal = colorCount();
+			std::vector<Scalar> products(colorTotal * size);
+			std::array<Scalar, size> direction{};
+			Scalar value = colorTotal == 0 ? expr(values) : Scalar(0);
+			for (std::size_t color = 0; color < colorTotal; ++color) {
+				for (std::size_t i = 0; i < size; ++i) direction[i] = colors[i] == color ? Scalar(1) : Scalar(0);
+				value = multiVarDiff::hessianVector(expr, values, direction, std::span<Scalar>{products}.subspan(color * size, size));
+			}
+			for (std::size_t k = 0; k < sources.size(); ++k) out.values[k] = products[sources[k].color * size + sources[k].row];
+			return value;
+		}
+
+		Matrix<Scalar> operator()(std::span<const Scalar> values) const {
+			Matrix<Scalar> out = matrix();
+			evaluate(values, out);
+			return out;
+		}
+
+	private:
+		// entry k is row `row` of the Hessian-vector product of color `color`
+		struct Source {
+			std::size_t color;
+			std::size_t row;
+		};
+
+		Expr expr;
+		Pattern entries;
+		std::vector<std::size_t> colors;
+		std::vector<Source> sources;
+	};
+
+}
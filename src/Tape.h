@@ -0,0 +1,312 @@
+#pragma once
+#include <algorithm>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+#include "Elementary.h"
+#include "Graph.h"
+
+// operator-overloading reverse mode - for models with loops and data-dependent branches that expression templates
+// cannot spell. Arithmetic on BasicActive records graph::Nodes into the thread's tape, and a reverse sweep over the
+// tape gives the gradient
+namespace tape {
+
+	// Bump-pointer allocator over a chain of blocks. reset() rewinds to the first block without freeing, so once the
+	// chain has grown to a recording's peak, later recordings of the same size allocate nothing from the heap
+	class Arena {
+	public:
+		explicit Arena(std::size_t blockSize = std::size_t(1) << 20) : blockSize(blockSize) {}
+
+		void* allocate(std::size_t bytes, std::size_t alignment) {
+			for (;; ++current, offset = 0) {
+				if (current == blocks.size()) {
+					std::size_t size = std::max(blocks.empty() ? blockSize : blocks.back().size * 2, bytes + alignment);
+					blocks.push_back({std::make_unique<std::byte[]>(size), size});
+				}
+				Block& block = blocks[current];
+				std::uintptr_t base = reinterpret_cast<std::uintptr_t>(block.data.get());
+				std::size_t start = ((base + offset + alignment - 1) & ~std::uintptr_t(alignment - 1)) - base;
+				if (start + bytes <= block.size) {
+					offset = start + bytes;
+					return block.data.get() + start;
+				}
+			}
+		}
+
+		// uninitialized storage for count objects of an implicit-lifetime type
+		template <typename T>
+		T* allocate(std::size_t count) { return static_cast<T*>(allocate(count * sizeof(T), alignof(T))); }
+
+		// O(1) - everything allocated so far is released at once and its blocks are reused
+		void reset() {
+			current = 0;
+			offset = 0;
+		}
+
+		std::size_t capacity() const {
+			std::size_t total = 0;
+			for (const Block& block : blocks) total += block.size;
+			return total;
+		}
+
+	private:
+		struct Block {
+			std::unique_ptr<std::byte[]> data;
+			std::size_t size;
+		};
+
+		std::vector<Block> blocks;
+		std::size_t blockSize;
+		std::size_t current = 0;
+		std::size_t offset = 0;
+	};
+
+	template <typename Scalar>
+	struct BasicActive;
+
+	// Recorded computation in evaluation order. Entries are graph::Nodes - a Variable's lhs is its input slot, a
+	// Constant's payload its value - with the value they had and an adjoint for the reverse sweep. Entries live in
+	// fixed-size pages taken from the arena, so recording never moves earlier entries. Comparisons of actives are
+	// kept beside the entries as branches, for replay
+	template <typename Scalar>
+	class BasicTape {
+	public:
+		struct Entry {
+			graph::Node<Scalar> node;
+			Scalar value;
+			Scalar adjoint;
+		};
+
+		static constexpr std::size_t pageBits = 12;
+		static constexpr std::size_t pageSize = std::size_t(1) << pageBits;
+
+		BasicTape() = default;
+		BasicTape(const BasicTape&) = delete;
+		BasicTape& operator=(const BasicTape&) = delete;
+
+		// the tape BasicActive operators record to - one per thread, so actives must stay on the thread that made them
+		static BasicTape& local() {
+			thread_local BasicTape tape;
+			return tape;
+		}
+
+		// O(1) - starts a new recording; actives of the previous one must no longer be used
+		void clear() {
+			arena.reset();
+			pages.clear();
+			count = 0;
+			inputList.clear();
+			branches.clear();
+		}
+
+		// independent variable in the next input slot
+		BasicActive<Scalar> input(Scalar value) {
+			graph::NodeId id = record({graph::Op::Variable, static_cast<graph::NodeId>(inputList.size()), 0, 0}, value);
+			inputList.push_back(id);
+			return {value, id};
+		}
+
+		graph::NodeId record(const graph::Node<Scalar>& node, Scalar value) {
+			if ((count & (pageSize - 1)) == 0 && (count >> pageBits) == pages.size()) pages.push_back(arena.allocate<Entry>(pageSize));
+			(*this)[static_cast<graph::NodeId>(count)] = {node, value, 0};
+			return static_cast<graph::NodeId>(count++);
+		}
+
+		// entry of an active, or a new Constant entry for a passive value
+		graph::NodeId operand(const BasicActive<Scalar>& value) {
+			return value.isActive() ? value.index : record({graph::Op::Constant, 0, 0, value.value}, value.value);
+		}
+
+		// comparison of entries lhs and rhs that came out as ordering
+		void branch(graph::NodeId lhs, graph::NodeId rhs, std::partial_ordering ordering) { branches.push_back({lhs, rhs, ordering}); }
+
+		Entry& operator[](graph::NodeId id) { return pages[id >> pageBits][id & (pageSize - 1)]; }
+		const Entry& operator[](graph::NodeId id) const { return pages[id >> pageBits][id & (pageSize - 1)]; }
+
+		std::size_t size() const { return count; }
+		std::size_t inputCount() const { return inputList.size(); }
+		std::size_t branchCount() const { return branches.size(); }
+
+		// Reruns the recording with inputs[slot] in place of every input slot, as a forward sweep over the stored
+		// entries; gradient() then differentiates at the new point. Returns false when a recorded comparison comes out
+		// differently - the values still follow the recorded branches, and the computation has to be recorded again
+		bool replay(std::span<const Scalar> inputs) {
+			for (std::size_t page = 0; page < pages.size(); ++page) {
+				Entry* entries = pages[page];
+				const std::size_t end = std::min(pageSize, count - page * pageSize);
+				for (std::size_t i = 0; i < end; ++i) {
+					Entry& entry = entries[i];
+					const graph::Node<Scalar>& node = entry.node;
+					switch (node.op) {
+					case graph::Op::Constant: break;
+					case graph::Op::Variable: entry.value = inputs[node.lhs]; break;
+					case graph::Op::Sum: entry.value = (*this)[node.lhs].value + (*this)[node.rhs].value; break;
+					case graph::Op::Difference: entry.value = (*this)[node.lhs].value - (*this)[node.rhs].value; break;
+					case graph::Op::Product: entry.value = (*this)[node.lhs].value * (*this)[node.rhs].value; break;
+					case graph::Op::Quotient: entry.value = (*this)[node.lhs].value / (*this)[node.rhs].value; break;
+					case graph::Op::Exp: entry.value = elementary::value<elementary::Function::Exp>((*this)[node.lhs].value); break;
+					case graph::Op::Log: entry.value = elementary::value<elementary::Function::Log>((*this)[node.lhs].value); break;
+					case graph::Op::Sin: entry.value = elementary::value<elementary::Function::Sin>((*this)[node.lhs].value); break;
+					case graph::Op::Cos: entry.value = elementary::value<elementary::Function::Cos>((*this)[node.lhs].value); break;
+					case graph::Op::Sqrt: entry.value = elementary::value<elementary::Function::Sqrt>((*this)[node.lhs].value); break;
+					case graph::Op::Pow: entry.value = elementary::pow((*this)[node.lhs].value, node.payload); break;
+					}
+				}
+			}
+
+			bool sameBranches = true;
+			for (const Branch& branch : branches) sameBranches &= ((*this)[branch.lhs].value <=> (*this)[branch.rhs].value) == branch.ordering;
+			return sameBranches;
+		}
+
+		// value of output at the last recording or replay
+		Scalar value(const BasicActive<Scalar>& output) const { return output.isActive() ? (*this)[output.index].value : output.value; }
+
+		// reverse sweep at the last recording or replay - partials[slot] receives d output / d input slot. Returns
+		// the value of output
+		Scalar gradient(const BasicActive<Scalar>& output, std::span<Scalar> partials) {
+			std::ranges::fill(partials, Scalar(0));
+			if (!output.isActive()) return output.value;
+			for (graph::NodeId i = 0; i <= output.index; ++i) (*this)[i].adjoint = 0;
+			(*this)[output.index].adjoint = 1;
+
+			for (graph::NodeId i = output.index + 1; i-- > 0;) {
+				const Entry& entry = (*this)[i];
+				const graph::Node<Scalar>& node = entry.node;
+				Scalar adjoint = entry.adjoint;
+				if (adjoint == 0) continue;
+
+				switch (node.op) {
+				case graph::Op::Constant: break;
+				case graph::Op::Variable: partials[node.lhs] += adjoint; break;
+				case graph::Op::Sum:
+					(*this)[node.lhs].adjoint += adjoint;
+					(*this)[node.rhs].adjoint += adjoint;
+					break;
+				case graph::Op::Difference:
+					(*this)[node.lhs].adjoint += adjoint;
+					(*this)[node.rhs].adjoint -= adjoint;
+					break;
+				case graph::Op::Product:
+					(*this)[node.lhs].adjoint += adjoint * (*this)[node.rhs].value;
+					(*this)[node.rhs].adjoint += adjoint * (*this)[node.lhs].value;
+					break;
+				case graph::Op::Quotient:
+					(*this)[node.lhs].adjoint += adjoint / (*this)[node.rhs].value;
+					(*this)[node.rhs].adjoint -= adjoint * entry.value / (*this)[node.rhs].value;
+					break;
+				default: (*this)[node.lhs].adjoint += adjoint * graph::slope(node, (*this)[node.lhs].value, entry.value); break;
+				}
+			}
+			return (*this)[output.index].value;
+		}
+
+	private:
+		struct Branch {
+			graph::NodeId lhs;
+			graph::NodeId rhs;
+			std::partial_ordering ordering;
+		};
+
+		Arena arena;
+		std::vector<Entry*> pages;
+		std::size_t count = 0;
+		std::vector<graph::NodeId> inputList;
+		std::vector<Branch> branches;
+	};
+
+	using Tape = BasicTape<float>;
+
+	// Active scalar. Values made from plain scalars are passive and record nothing until they meet an active one,
+	// so arithmetic on data alone stays off the tape
+	template <typename Scalar>
+	struct BasicActive {
+		static constexpr graph::NodeId passive = std::numeric_limits<graph::NodeId>::max();
+
+		BasicActive(Scalar value = 0) : value(value) {}
+		BasicActive(Scalar value, graph::NodeId index) : value(value), index(index) {}
+
+		bool isActive() const { return index != passive; }
+
+		friend BasicActive operator-(const BasicActive& u) { return binary(graph::Op::Difference, Scalar(0), u, -u.value); }
+		friend BasicActive operator+(const BasicActive& lhs, const BasicActive& rhs) { return binary(graph::Op::Sum, lhs, rhs, lhs.value + rhs.value); }
+		friend BasicActive operator-(const BasicActive& lhs, const BasicActive& rhs) { return binary(graph::Op::Difference, lhs, rhs, lhs.value - rhs.value); }
+		friend BasicActive operator*(const BasicActive& lhs, const BasicActive& rhs) { return binary(graph::Op::Product, lhs, rhs, lhs.value * rhs.value); }
+		friend BasicActive operator/(const BasicActive& lhs, const BasicActive& rhs) { return binary(graph::Op::Quotient, lhs, rhs, lhs.value / rhs.value); }
+
+		BasicActive& operator+=(const BasicActive& rhs) { return *this = *this + rhs; }
+		BasicActive& operator-=(const BasicActive& rhs) { return *this = *this - rhs; }
+		BasicActive& operator*=(const BasicActive& rhs) { return *this = *this * rhs; }
+		BasicActive& operator/=(const BasicActive& rhs) { return *this = *this / rhs; }
+
+		// comparisons involving an active value are recorded, so a replay can tell when a branch would go the other way.
+		// Branches on .value directly are not seen
+		friend std::partial_ordering operator<=>(const BasicActive& lhs, const BasicActive& rhs) { return compare(lhs, rhs); }
+		friend bool operator==(const BasicActive& lhs, const BasicActive& rhs) { return compare(lhs, rhs) == 0; }
+
+		// result of a unary node over u
+		static BasicActive unary(graph::Op op, const BasicActive& u, Scalar value, Scalar payload = 0) {
+			if (!u.isActive()) return value;
+			return {value, BasicTape<Scalar>::local().record({op, u.index, 0, payload}, value)};
+		}
+
+		Scalar value;
+		graph::NodeId index = passive;
+
+	private:
+		static BasicActive binary(graph::Op op, const BasicActive& lhs, const BasicActive& rhs, Scalar value) {
+			if (!lhs.isActive() && !rhs.isActive()) return value;
+			BasicTape<Scalar>& tape = BasicTape<Scalar>::local();
+			graph::NodeId l = tape.operand(lhs);
+			return {value, tape.record({op, l, tape.operand(rhs), 0}, value)};
+		}
+
+		static std::partial_ordering compare(const BasicActive& lhs, const BasicActive& rhs) {
+			std::partial_ordering ordering = lhs.value <=> rhs.value;
+			if (lhs.isActive() || rhs.isActive()) {
+				BasicTape<Scalar>& tape = BasicTape<Scalar>::local();
+				graph::NodeId l = tape.operand(lhs);
+				tape.branch(l, tape.operand(rhs), ordering);
+			}
+			return ordering;
+		}
+	};
+
+	using Active = BasicActive<float>;
+
+	template <typename Scalar>
+	BasicActive<Scalar> exp(const BasicActive<Scalar>& u) {
+		return BasicActive<Scalar>::unary(graph::Op::Exp, u, elementary::value<elementary::Function::Exp>(u.value));
+	}
+
+	template <typename Scalar>
+	BasicActive<Scalar> log(const BasicActive<Scalar>& u) {
+		return BasicActive<Scalar>::unary(graph::Op::Log, u, elementary::value<elementary::Function::Log>(u.value));
+	}
+
+	template <typename Scalar>
+	BasicActive<Scalar> sin(const BasicActive<Scalar>& u) {
+		return BasicActive<Scalar>::unary(graph::Op::Sin, u, elementary::value<elementary::Function::Sin>(u.value));
+	}
+
+	template <typename Scalar>
+	BasicActive<Scalar> cos(const BasicActive<Scalar>& u) {
+		return BasicActive<Scalar>::unary(graph::Op::Cos, u, elementary::value<elementary::Function::Cos>(u.value));
+	}
+
+	template <typename Scalar>
+	BasicActive<Scalar> sqrt(const BasicActive<Scalar>& u) {
+		return BasicActive<Scalar>::unary(graph::Op::Sqrt, u, elementary::value<elementary::Function::Sqrt>(u.value));
+	}
+
+	template <typename Scalar>
+	BasicActive<Scalar> pow(const BasicActive<Scalar>& u, std::type_identity_t<Scalar> exponent) {
+		return BasicActive<Scalar>::unary(graph::Op::Pow, u, elementary::pow(u.value, exponent), exponent);
+	}
+
+}
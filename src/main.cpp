@@ -1,5 +1,63 @@
 #include "MultiVarDiff.h"
+#include <array>
+#include <cstddef>
 #include <iostream>
+#include <tuple>
+
+// expressions are literal types - construction, differentiation and evaluation can all run in the compiler
+namespace compileTime {
+
+	constexpr multiVarDiff::IndexedVariable<0> u;
+	constexpr multiVarDiff::IndexedVariable<1> v;
+	constexpr auto expression = u * u + 4 * v * v / (u + 6);
+	constexpr std::array<float, 2> point{2, 4};
+
+	static_assert(expression(point) == 12);
+	static_assert(expression.dx(u)(point) == 3);
+	static_assert(expression.dx(v)(point) == 4);
+	static_assert(expression.dx(u).dx(u)(point) == 2.25f);
+
+	// reverse accumulation and Hessians too
+	constexpr std::array<float, 2> partials = [] {
+		std::array<float, 2> partials{};
+		multiVarDiff::gradient(expression, point, partials);
+		return partials;
+	}();
+	static_assert(partials[0] == 3 && partials[1] == 4);
+
+	constexpr std::array<float, 4> hessian = [] {
+		std::array<float, 4> hessian{};
+		multiVarDiff::hessian(expression, point, hessian);
+		return hessian;
+	}();
+	static_assert(hessian[0] == 2.25f && hessian[1] == hessian[2]);
+
+	// variables bound by address compare addresses, so they live inside the evaluation
+	constexpr float boundDerivative = [] {
+		multiVarDiff::Variable x;
+		multiVarDiff::Variable y;
+		return (x * x + 4 * y * y / (x + 6)).dx(y)(x = 2, y = 4);
+	}();
+	static_assert(boundDerivative == 4);
+
+	// constant Jacobian of a linear map
+	constexpr std::array<float, 4> linear = [] {
+		std::array<float, 4> jacobian{};
+		multiVarDiff::jacobian(std::tuple{2 * u + 3 * v, u - v}, point, jacobian, multiVarDiff::Layout::RowMajor);
+		return jacobian;
+	}();
+	static_assert(linear == std::array<float, 4>{2, 3, 1, -1});
+
+	// lookup table of slopes, generated at compile time
+	constexpr auto cubeSlopes = [] {
+		constexpr auto slope = (u * u * u).dx(u);
+		std::array<float, 8> table{};
+		for (std::size_t i = 0; i < table.size(); ++i) table[i] = slope(std::array<float, 1>{float(i)});
+		return table;
+	}();
+	static_assert(cubeSlopes[5] == 75);
+
+}
 
 int main() {
 	multiVarDiff::Variable x;
@@ -16,5 +74,25 @@ int main() {
 	std::cout << "dExpr_dx(x=10, y=200): " << dExpr_dx(x = 10, y = 200) << std::endl;
 	std::cout << "dExpr_dy(x=10, y=200): " << dExpr_dy(x = 10, y = 200) << std::endl;
 
+	// all partials at once by reverse accumulation
+	auto grad = multiVarDiff::gradient(expression, x = 10, y = 200);
+	std::cout << "grad(x=10, y=200): (" << grad[0] << ", " << grad[1] << ")" << std::endl;
+
+	// same expression with variables bound by index into a flat array of values
+	multiVarDiff::IndexedVariable<0> u;
+	multiVarDiff::IndexedVariable<1> v;
+
+	auto indexedExpression = u * u + 4 * v * v / (u + 5);
+	std::array<float, 2> values{10, 200};
+
+	std::cout << "dExpr_du(u=10, v=200): " << indexedExpression.dx(u)(values) << std::endl;
+	std::cout << "dExpr_dv(u=10, v=200): " << indexedExpression.dx(v)(values) << std::endl;
+
+	// elementary functions - softplus(u) * sin(v)
+	auto softplus = log(1 + exp(u)) * sin(v);
+	std::array<float, 2> partials{};
+	float softplusValue = multiVarDiff::gradient(softplus, std::array<float, 2>{1, 2}, partials);
+	std::cout << "softplus(u=1) * sin(v=2): " << softplusValue << ", grad: (" << partials[0] << ", " << partials[1] << ")" << std::endl;
+
 	return 0;
 }
\ No newline at end of file
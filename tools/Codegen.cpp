@@ -0,0 +1,102 @@
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "CodeGen.h"
+#include "Graph.h"
+#include "Parser.h"
+
+// Writes a header of inline functions for an expression and its gradient:
+//   AutoDifferentiationCodegen --name=rosenbrock --variables=x,y [--scalar=float|double] [--output=file.h] "(1 - x)^2 + 100 * (y - x^2)^2"
+// defines rosenbrock(x, y) and rosenbrockGradient(x, y, ad_partials). Names must be C++ identifiers that are not
+// keywords and do not start with ad_, the prefix of the generated locals
+
+namespace {
+
+	struct Options {
+		std::string name;
+		std::vector<std::string> variables;
+		std::string scalar = "float";
+		std::string output;
+		std::string expression;
+	};
+
+	std::vector<std::string> split(std::string_view list) {
+		std::vector<std::string> parts;
+		while (!list.empty()) {
+			std::size_t comma = list.find(',');
+			parts.emplace_back(list.substr(0, comma));
+			if (comma == std::string_view::npos) break;
+			list.remove_prefix(comma + 1);
+		}
+		return parts;
+	}
+
+	template <typename Scalar>
+	std::string generate(const Options& options) {
+		// reject names the generated code cannot spell before the parser sees them
+		codegen::checkName(options.name);
+		for (const std::string& variable : options.variables) codegen::checkName(variable);
+
+		graph::Graph<Scalar> expr;
+		graph::NodeId root = graph::parse(expr, options.expression, options.variables);
+
+		std::ostringstream out;
+		out << "// generated by AutoDifferentiationCodegen - do not edit\n// " << options.expression << "\n";
+		codegen::emitHeader(out, expr, root, options.name, options.variables);
+		return out.str();
+	}
+
+}
+
+int main(int argc, char** argv) {
+	Options options;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.starts_with("--name=")) options.name = arg.substr(std::strlen("--name="));
+		else if (arg.starts_with("--variables=")) options.variables = split(arg.substr(std::strlen("--variables=")));
+		else if (arg.starts_with("--scalar=")) options.scalar = arg.substr(std::strlen("--scalar="));
+		else if (arg.starts_with("--output=")) options.output = arg.substr(std::strlen("--output="));
+		else if (!arg.starts_with("--") && options.expression.empty()) options.expression = arg;
+		else {
+			std::fprintf(stderr, "unknown argument %s\n", argv[i]);
+			return 1;
+		}
+	}
+	if (options.name.empty() || options.expression.empty()) {
+		std::fprintf(stderr, "usage: %s --name=<function> --variables=<x,y,...> [--scalar=float|double] [--output=<file>] <expression>\n", argv[0]);
+		return 1;
+	}
+
+	std::string header;
+	try {
+		if (options.scalar == "float") header = generate<float>(options);
+		else if (options.scalar == "double") header = generate<double>(options);
+		else {
+			std::fprintf(stderr, "unknown scalar %s\n", options.scalar.c_str());
+			return 1;
+		}
+	}
+	catch (const std::exception& error) {
+		std::fprintf(stderr, "%s\n", error.what());
+		return 1;
+	}
+
+	if (options.output.empty()) {
+		std::cout << header;
+		return 0;
+	}
+
+	std::ofstream file(options.output);
+	if (!file) {
+		std::fprintf(stderr, "cannot open %s\n", options.output.c_str());
+		return 1;
+	}
+	file << header;
+	return 0;
+}